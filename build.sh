@@ -4,6 +4,10 @@ COMPILER="clang++"
 
 BUILD_MODE="debug"
 
+TARGET="sim8086"
+
+EXTRA_FLAGS=""
+
 for arg in "$@"; do
     case $arg in
         g++|clang++)
@@ -12,9 +16,15 @@ for arg in "$@"; do
         debug|release)
             BUILD_MODE="$arg"
             ;;
+        instrument)
+            EXTRA_FLAGS="-DINSTRUMENT"
+            ;;
+        sim8086|benchmark|fuzz|all)
+            TARGET="$arg"
+            ;;
         *)
             echo "Unknown Argument: $arg"
-            echo "Usage: $0 [g++|clang++] [debug|release]"
+            echo "Usage: $0 [g++|clang++] [debug|release] [instrument] [sim8086|benchmark|fuzz|all]"
             exit 1
             ;;
     esac
@@ -28,12 +38,20 @@ fi
 
 mkdir -p build
 
-$COMPILER $FLAGS -std=c++20 -Wall -Werror -o build/sim8086 src/sim8086.cpp
-
-if [ $? -eq 0 ]; then
-    echo "[SUCCESS] Compilation successful! Executable created in: build/main"
+if [ "$TARGET" = "all" ]; then
+    TARGETS="sim8086 benchmark fuzz"
 else
-    echo "[ERROR] Compilation failed"
-    exit 1
+    TARGETS="$TARGET"
 fi
 
+for target in $TARGETS; do
+    $COMPILER $FLAGS $EXTRA_FLAGS -std=c++20 -Wall -Werror -o build/$target src/$target.cpp
+
+    if [ $? -eq 0 ]; then
+        echo "[SUCCESS] Compilation successful! Executable created in: build/$target"
+    else
+        echo "[ERROR] Compilation failed"
+        exit 1
+    fi
+done
+
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "output_buffer.h"
+
+// Disassembles many files in one process. Threads take files in input
+// order and format each into one of 2 x threads reused slot buffers, so a
+// small file costs no allocation. A thread that gets that far ahead of the
+// next result to be written waits, which bounds the text held in memory by
+// the slots whatever the size of the corpus. Results are written in input
+// order: either as one stream where every file is preceded by a
+// `; file LENGTH PATH` frame line, LENGTH being the byte count of the text
+// that follows it, or each to PATH.asm next to its input.
+class BatchDisassembler {
+public:
+    // Without `framed`, the stream holds the results alone, for output that carries its own file names.
+    BatchDisassembler(unsigned threads, bool per_file, bool framed = true)
+        : threads(std::max(threads, 1u)), slots(2 * this->threads), per_file(per_file), framed(framed) {}
+
+    // Expands the arguments into the list of files to decode: a directory
+    // adds every regular file below it in sorted order, except PATH.asm next
+    // to a PATH it also adds, which is that file's --per-file output. `@LIST`
+    // adds the paths listed one per line in LIST (`@-` reads them from stdin).
+    static std::vector<std::string> collectPaths(const std::vector<std::string>& args) {
+        std::vector<std::string> paths;
+
+        for (const std::string& arg : args) {
+            if (arg.starts_with('@')) {
+                std::string list = arg.substr(1);
+                std::ifstream file;
+                if (list != "-") {
+                    file.open(list);
+                    if (!file) throw std::runtime_error("[ERROR] Cannot open file list: " + list);
+                }
+                std::istream& in = (list == "-") ? std::cin : file;
+                for (std::string line; std::getline(in, line);) {
+                    if (!line.empty()) paths.push_back(line);
+                }
+            } else if (std::filesystem::is_directory(arg)) {
+                std::vector<std::string> found;
+                for (const auto& entry : std::filesystem::recursive_directory_iterator(arg)) {
+                    if (entry.is_regular_file()) found.push_back(entry.path().string());
+                }
+                std::sort(found.begin(), found.end());
+                for (const std::string& path : found) {
+                    bool output = path.ends_with(".asm")
+                        && std::binary_search(found.begin(), found.end(), path.substr(0, path.size() - 4));
+                    if (!output) paths.push_back(path);
+                }
+            } else {
+                paths.push_back(arg);
+            }
+        }
+
+        return paths;
+    }
+
+    // Runs `job(input, path, text)` for every file, where `text` is a slot
+    // buffer, cleared for each file. Errors are reported on stderr in input
+    // order after the file's partial output, each prefixed with its path.
+    // Returns the number of failed files.
+    template<typename Job>
+    std::size_t run(const std::vector<std::string>& paths, OutputBuffer& output, const Job& job) {
+        next_task = 0;
+        written = 0;
+
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; t++) {
+            pool.emplace_back([this, &paths, &job]() { work(paths, job); });
+        }
+
+        std::size_t failed = 0;
+        for (std::size_t i = 0; i < paths.size(); i++) {
+            Slot& slot = waitFor(i);
+
+            if (!per_file) {
+                if (framed) {
+                    output.reserve(paths[i].size() + 32);
+                    output.put("; file ");
+                    output.putInt(slot.text.view().size());
+                    output.put(' ');
+                    output.put(paths[i]);
+                    output.put('\n');
+                }
+                output.append(slot.text.view());
+            }
+            if (!slot.error.empty()) {
+                output.flush();
+                std::cerr << slot.error << std::endl;
+                failed++;
+            }
+
+            std::lock_guard guard(lock);
+            slot.ready = false;
+            slot.error.clear();
+            written = i + 1;
+            slot_free.notify_all();
+        }
+
+        for (auto& thread : pool) thread.join();
+        return failed;
+    }
+
+private:
+    struct Slot {
+        OutputBuffer text;
+        std::string error;
+        bool ready = false;
+    };
+
+    unsigned threads;
+    // File i goes to slots[i % slots.size()], free once file i - slots.size() is written.
+    std::vector<Slot> slots;
+    bool per_file;
+    bool framed;
+
+    std::mutex lock;
+    std::condition_variable slot_ready;
+    std::condition_variable slot_free;
+    std::size_t next_task = 0;
+    std::size_t written = 0;
+
+    template<typename Job>
+    void work(const std::vector<std::string>& paths, const Job& job) {
+        std::size_t index;
+
+        while (take(paths.size(), index)) {
+            const std::string& path = paths[index];
+            Slot& slot = slots[index % slots.size()];
+            slot.text.clear();
+            std::string error;
+
+            try {
+                // Checked before opening too, as opening a FIFO waits for a writer.
+                std::error_code ec;
+                std::filesystem::file_status status = std::filesystem::status(path, ec);
+                if (!std::filesystem::exists(status)) {
+                    throw std::runtime_error("[ERROR] Does not exist or cannot be opened.");
+                }
+                if (!std::filesystem::is_regular_file(status)) {
+                    throw std::runtime_error("[ERROR] Not a regular file.");
+                }
+                InputFile input(path);
+                if (!input.isRegular()) {
+                    throw std::runtime_error("[ERROR] Not a regular file.");
+                }
+                job(input, path, slot.text);
+            } catch (const std::runtime_error& e) {
+                error = withPath(path, e.what());
+            }
+
+            if (per_file && !writeFile(path + ".asm", slot.text.view()) && error.empty()) {
+                error = withPath(path, "[ERROR] Cannot write output: " + path + ".asm");
+            }
+
+            std::lock_guard guard(lock);
+            slot.error = std::move(error);
+            slot.ready = true;
+            slot_ready.notify_one();
+        }
+    }
+
+    // Hands out files in input order. The writer always waits for a file that
+    // has been handed out already, so a thread waiting here never blocks it.
+    bool take(std::size_t count, std::size_t& index) {
+        std::unique_lock guard(lock);
+        if (next_task >= count) return false;
+
+        index = next_task++;
+        slot_free.wait(guard, [&]() { return index < written + slots.size(); });
+        return true;
+    }
+
+    Slot& waitFor(std::size_t index) {
+        std::unique_lock guard(lock);
+        Slot& slot = slots[index % slots.size()];
+        slot_ready.wait(guard, [&]() { return slot.ready; });
+        return slot;
+    }
+
+    // "[ERROR] PATH: message" from an "[ERROR] message".
+    static std::string withPath(const std::string& path, std::string_view message) {
+        constexpr std::string_view tag = "[ERROR] ";
+        if (message.starts_with(tag)) message.remove_prefix(tag.size());
+        return std::string(tag) + path + ": " + std::string(message);
+    }
+
+    static bool writeFile(const std::string& path, std::string_view text) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+
+        bool ok = true;
+        while (ok && !text.empty()) {
+            ssize_t written = ::write(fd, text.data(), text.size());
+            if (written < 0 && errno == EINTR) continue;
+            ok = written >= 0;
+            if (ok) text.remove_prefix(written);
+        }
+        return (::close(fd) == 0) && ok;
+    }
+};
@@ -0,0 +1,208 @@
+#include <iostream>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <span>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "decoder.h"
+#include "input.h"
+#include "nasm_formatter.h"
+#include "output_buffer.h"
+
+// Decoder throughput on the synthetic corpora, in three modes:
+//   decode   records only, into a reused batch
+//   format   decode and format into a memory buffer that is cleared per batch
+//   end2end  map a file, decode, format and write to /dev/null, as sim8086 does
+// Each measurement is the best of several runs. Results are printed as JSON,
+// one result per line; with --baseline, a previous run's results are compared
+// and any mode that lost more than the threshold fails the run.
+
+struct Result {
+    std::string corpus;
+    std::string mode;
+    std::size_t bytes;
+    std::size_t instructions;
+    double seconds;
+
+    double megabytesPerSecond() const { return bytes / seconds / 1e6; }
+    double nanosecondsPerInstruction() const { return seconds * 1e9 / instructions; }
+};
+
+template<typename Run>
+static double bestOf(int repeat, const Run& run) {
+    double best = 1e30;
+    for (int i = 0; i < repeat; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+static std::size_t decodeOnly(std::span<const u8> code) {
+    InstructionDecoder decoder(code);
+    std::array<DecodedInstruction, 1024> batch;
+    std::size_t total = 0;
+    while (std::size_t count = decoder.decode(batch.data(), batch.size())) total += count;
+    return total;
+}
+
+static void decodeAndFormat(std::span<const u8> code, OutputBuffer& text) {
+    InstructionDecoder decoder(code);
+    NasmFormatter formatter(text);
+    std::array<DecodedInstruction, 1024> batch;
+    while (std::size_t count = decoder.decode(batch.data(), batch.size())) {
+        for (std::size_t i = 0; i < count; i++) formatter.format(batch[i]);
+        text.clear();
+    }
+}
+
+static void endToEnd(const std::string& path, int null_fd) {
+    InputFile input(path);
+    OutputBuffer output(null_fd);
+    NasmFormatter formatter(output);
+    formatter.header();
+
+    InstructionDecoder decoder(input.bytes());
+    std::array<DecodedInstruction, 1024> batch;
+    while (std::size_t count = decoder.decode(batch.data(), batch.size())) {
+        for (std::size_t i = 0; i < count; i++) formatter.format(batch[i]);
+    }
+    output.flush();
+}
+
+static std::vector<Result> measure(std::string_view name, std::size_t size, int repeat, int null_fd) {
+    std::vector<u8> image = Corpus::make(name, size);
+    std::size_t instructions = decodeOnly(image);
+    std::vector<Result> results;
+
+    double seconds = bestOf(repeat, [&]() { decodeOnly(image); });
+    results.push_back({std::string(name), "decode", image.size(), instructions, seconds});
+
+    OutputBuffer text;
+    seconds = bestOf(repeat, [&]() { decodeAndFormat(image, text); });
+    results.push_back({std::string(name), "format", image.size(), instructions, seconds});
+
+    char path[] = "/tmp/sim8086-benchmark-XXXXXX";
+    int fd = ::mkstemp(path);
+    if (fd < 0) throw std::runtime_error("[ERROR] Cannot create a temporary file.");
+    bool written = ::write(fd, image.data(), image.size()) == static_cast<ssize_t>(image.size());
+    ::close(fd);
+    if (!written) {
+        ::unlink(path);
+        throw std::runtime_error("[ERROR] Cannot write a temporary file.");
+    }
+    seconds = bestOf(repeat, [&]() { endToEnd(path, null_fd); });
+    results.push_back({std::string(name), "end2end", image.size(), instructions, seconds});
+    ::unlink(path);
+
+    return results;
+}
+
+static void printResult(const Result& result, bool last) {
+    std::printf("  {\"corpus\": \"%s\", \"mode\": \"%s\", \"bytes\": %zu, \"instructions\": %zu, \"seconds\": %.6f, "
+                "\"mb_per_s\": %.2f, \"ns_per_instruction\": %.3f}%s\n",
+                result.corpus.c_str(), result.mode.c_str(), result.bytes, result.instructions, result.seconds,
+                result.megabytesPerSecond(), result.nanosecondsPerInstruction(), last ? "" : ",");
+}
+
+static std::string field(const std::string& line, const std::string& key) {
+    std::string quoted = "\"" + key + "\": ";
+    std::size_t pos = line.find(quoted);
+    if (pos == std::string::npos) return {};
+    pos += quoted.size();
+    if (line[pos] == '"') {
+        pos++;
+        return line.substr(pos, line.find('"', pos) - pos);
+    }
+    return line.substr(pos, line.find_first_of(",}", pos) - pos);
+}
+
+// Throughput per "corpus/mode" from a file this program wrote.
+static std::map<std::string, double> loadBaseline(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) throw std::runtime_error("[ERROR] Cannot open baseline: " + path);
+
+    std::map<std::string, double> baseline;
+    for (std::string line; std::getline(file, line);) {
+        std::string corpus = field(line, "corpus");
+        std::string rate = field(line, "mb_per_s");
+        if (!corpus.empty() && !rate.empty()) baseline[corpus + "/" + field(line, "mode")] = std::stod(rate);
+    }
+    return baseline;
+}
+
+// Prints the change against the baseline on stderr; returns the number of regressions.
+static int compare(const std::vector<Result>& results, const std::map<std::string, double>& baseline, double threshold) {
+    int regressions = 0;
+    for (const Result& result : results) {
+        auto it = baseline.find(result.corpus + "/" + result.mode);
+        if (it == baseline.end()) continue;
+
+        double change = (result.megabytesPerSecond() / it->second - 1) * 100;
+        bool regressed = change < -threshold;
+        regressions += regressed;
+        std::fprintf(stderr, "%-9s %-8s %10.2f -> %10.2f MB/s  %+6.1f%%%s\n", result.corpus.c_str(), result.mode.c_str(),
+                     it->second, result.megabytesPerSecond(), change, regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+int main(int argc, char* argv[]) {
+    std::size_t size = 16 << 20;
+    int repeat = 5;
+    double threshold = 5;
+    std::vector<std::string> corpora;
+    std::string baseline_path;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) {
+            size = std::stoull(argv[++i]) << 20;
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(std::stoi(argv[++i]), 1);
+        } else if (arg == "--corpus" && i + 1 < argc) {
+            corpora.push_back(argv[++i]);
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            threshold = std::stod(argv[++i]);
+        } else {
+            std::cout << "[ERROR] Usage: " << argv[0] << " [--size MB] [--repeat N] [--corpus opcodes|prefixes|random|mixed]... [--baseline results.json] [--threshold percent]" << std::endl;
+            return 1;
+        }
+    }
+    if (corpora.empty()) corpora.assign(std::begin(Corpus::kNames), std::end(Corpus::kNames));
+
+    int null_fd = ::open("/dev/null", O_WRONLY);
+    std::vector<Result> results;
+    int regressions = 0;
+
+    try {
+        for (const std::string& name : corpora) {
+            if (std::find(std::begin(Corpus::kNames), std::end(Corpus::kNames), name) == std::end(Corpus::kNames)) {
+                throw std::runtime_error("[ERROR] Unknown corpus: " + name);
+            }
+            for (Result& result : measure(name, size, repeat, null_fd)) results.push_back(std::move(result));
+        }
+
+        if (!baseline_path.empty()) regressions = compare(results, loadBaseline(baseline_path), threshold);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::printf("{\"results\": [\n");
+    for (std::size_t i = 0; i < results.size(); i++) printResult(results[i], i + 1 == results.size());
+    std::printf("]}\n");
+
+    ::close(null_fd);
+    return regressions ? 2 : 0;
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+
+#include "executable.h"
+#include "input.h"
+#include "instruction.h"
+#include "output_buffer.h"
+
+// Decoder output as fixed-width little-endian records, for tools that would
+// otherwise parse the text back. A stream is one BinaryHeader followed by one
+// BinaryRecord per DecodedInstruction, in offset order; the record count
+// follows from the stream size, so it can be written to a pipe. Records hold
+// everything the formatter uses, so a reader can reproduce the text exactly.
+static_assert(std::endian::native == std::endian::little);
+
+struct BinaryHeader {
+    char magic[8];
+    u32 version;
+    u32 record_size;
+    u32 origin;       // offset of the image's first byte: 0x100 for .COM
+    u8 format;        // ImageFormat
+    u8 reserved[3];
+};
+
+struct BinaryRecord {
+    u32 offset;
+    u8 length;
+    u8 operation;     // Operation
+    u8 opcode;
+    u8 modrm;
+    u8 prefixes;      // Prefix bits; with Prefix::Segment, bits 4-5 select es, cs, ss or ds
+    u8 flags;         // InstructionFlags
+    u8 operands[2];   // OperandKind in bits 5-7, operand value in bits 0-4
+    i16 displacement;
+    u16 immediate;
+};
+
+static_assert(sizeof(BinaryHeader) == 24);
+static_assert(sizeof(BinaryRecord) == 16 && std::is_trivial_v<BinaryRecord>);
+
+inline constexpr char kBinaryMagic[8] = {'S', '8', '6', 'D', 'E', 'C', '\0', '\0'};
+inline constexpr u32 kBinaryVersion = 2;
+
+inline BinaryRecord toRecord(const DecodedInstruction& instr) {
+    BinaryRecord record;
+    record.offset = static_cast<u32>(instr.offset);
+    record.length = instr.length;
+    record.operation = static_cast<u8>(instr.operation);
+    record.opcode = instr.opcode;
+    record.modrm = instr.modrm;
+    record.prefixes = instr.prefixes;
+    if (instr.prefixes & Prefix::Segment) {
+        record.prefixes |= (static_cast<u8>(instr.segment) - static_cast<u8>(Register::Es)) << 4;
+    }
+    record.flags = instr.flags;
+    for (int i = 0; i < 2; i++) {
+        record.operands[i] = static_cast<u8>(instr.operands[i].kind) << 5 | instr.operands[i].value;
+    }
+    record.displacement = instr.displacement;
+    record.immediate = instr.immediate;
+    return record;
+}
+
+// Whether every field toInstruction reads, and the formatter indexes tables
+// with, is one the writer can produce.
+inline bool isValidRecord(const BinaryRecord& record) {
+    if (record.operation >= static_cast<u8>(Operation::Count)) return false;
+    if (record.prefixes >> 6) return false;
+    if ((record.prefixes >> 4) && !(record.prefixes & Prefix::Segment)) return false;
+
+    for (u8 operand : record.operands) {
+        u8 value = operand & 0x1F;
+        switch (static_cast<OperandKind>(operand >> 5)) {
+            case OperandKind::None:
+            case OperandKind::Far:
+                if (value != 0) return false;
+                break;
+            case OperandKind::Register:
+                if (value > static_cast<u8>(Register::Ds)) return false;
+                break;
+            case OperandKind::Memory:
+                if (value > static_cast<u8>(EffectiveAddress::Direct)) return false;
+                break;
+            case OperandKind::Immediate:
+            case OperandKind::SignedImmediate:
+            case OperandKind::Relative:
+                if (value > 2) return false;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+inline DecodedInstruction toInstruction(const BinaryRecord& record) {
+    DecodedInstruction instr{};
+    instr.offset = record.offset;
+    instr.length = record.length;
+    instr.operation = static_cast<Operation>(record.operation);
+    instr.opcode = record.opcode;
+    instr.modrm = record.modrm;
+    instr.prefixes = record.prefixes & 0xF;
+    if (instr.prefixes & Prefix::Segment) {
+        instr.segment = getSegReg(record.prefixes >> 4);
+    }
+    instr.flags = record.flags;
+    for (int i = 0; i < 2; i++) {
+        instr.operands[i] = {static_cast<OperandKind>(record.operands[i] >> 5), static_cast<u8>(record.operands[i] & 0x1F)};
+    }
+    instr.displacement = record.displacement;
+    instr.immediate = record.immediate;
+    return instr;
+}
+
+// Appends records to an output buffer, which writes them out in bulk.
+// Offsets are 32-bit, so images are limited to 4 GB.
+class BinaryWriter {
+public:
+    BinaryWriter(OutputBuffer& out) : out(out) {}
+
+    void header(std::size_t origin = 0, ImageFormat format = ImageFormat::Flat) {
+        BinaryHeader header{};
+        std::memcpy(header.magic, kBinaryMagic, sizeof(kBinaryMagic));
+        header.version = kBinaryVersion;
+        header.record_size = sizeof(BinaryRecord);
+        header.origin = static_cast<u32>(origin);
+        header.format = static_cast<u8>(format);
+        put(&header, sizeof(header));
+    }
+
+    void format(const DecodedInstruction& instr) {
+        if (instr.offset > UINT32_MAX) {
+            throw std::runtime_error("[ERROR] Binary output is limited to 4 GB images.");
+        }
+        BinaryRecord record = toRecord(instr);
+        put(&record, sizeof(record));
+    }
+
+private:
+    OutputBuffer& out;
+
+    void put(const void* data, std::size_t size) {
+        out.append({static_cast<const char*>(data), size});
+    }
+};
+
+// Maps a record stream written by BinaryWriter. Throws if the file is not
+// one, was written by another version, ends inside a record, or holds a
+// record no writer produces.
+class BinaryReader {
+public:
+    BinaryReader(const std::string& filename) : input(filename) {
+        std::span<const u8> bytes = input.bytes();
+        if (!input.isMapped() || bytes.size() < sizeof(BinaryHeader)) {
+            throw std::runtime_error("[ERROR] Not a decoded instruction file: " + filename);
+        }
+
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        if (std::memcmp(header.magic, kBinaryMagic, sizeof(kBinaryMagic)) != 0) {
+            throw std::runtime_error("[ERROR] Not a decoded instruction file: " + filename);
+        }
+        if (header.version != kBinaryVersion || header.record_size != sizeof(BinaryRecord)) {
+            throw std::runtime_error("[ERROR] Unsupported decoded instruction file version: " + filename);
+        }
+        if ((bytes.size() - sizeof(header)) % sizeof(BinaryRecord) != 0) {
+            throw std::runtime_error("[ERROR] Truncated decoded instruction file: " + filename);
+        }
+
+        // The header keeps the records at their natural alignment in the mapping.
+        data = {reinterpret_cast<const BinaryRecord*>(bytes.data() + sizeof(header)), (bytes.size() - sizeof(header)) / sizeof(BinaryRecord)};
+        if (!std::all_of(data.begin(), data.end(), isValidRecord)) {
+            throw std::runtime_error("[ERROR] Not a decoded instruction file: " + filename);
+        }
+    }
+
+    std::span<const BinaryRecord> records() const { return data; }
+
+    // Where the records' image was loaded, for the listing's `org` line.
+    std::size_t origin() const { return header.origin; }
+
+    ImageFormat format() const { return static_cast<ImageFormat>(header.format); }
+
+    std::size_t size() const { return data.size(); }
+
+    DecodedInstruction operator[](std::size_t index) const { return toInstruction(data[index]); }
+
+private:
+    InputFile input;
+    BinaryHeader header{};
+    std::span<const BinaryRecord> data;
+};
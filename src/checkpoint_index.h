@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "instruction.h"
+#include "length_decoder.h"
+
+// Sparse index of known instruction boundaries: the first record start at or
+// after every multiple of `interval` bytes, found by one length-only pass.
+// A range can then be decoded from the closest checkpoint instead of from
+// byte 0. The index is saved next to the image and checked against its size,
+// modification time and the bytes at every checkpoint before it is trusted again.
+class CheckpointIndex {
+public:
+    static constexpr u32 kDefaultInterval = 64 << 10;
+
+    static CheckpointIndex build(std::span<const u8> code, u64 modified, u32 interval = kDefaultInterval) {
+        CheckpointIndex index;
+        index.interval = interval;
+        index.image_size = code.size();
+        index.modified = modified;
+
+        LengthDecoder decoder(code);
+        std::array<std::size_t, 4096> starts;
+        std::size_t next = 0;
+
+        while (std::size_t count = decoder.boundaries(starts.data(), starts.size())) {
+            for (std::size_t i = 0; i < count; i++) {
+                if (starts[i] < next) continue;
+                index.checkpoints.push_back(starts[i]);
+                next = (starts[i] / interval + 1) * static_cast<std::size_t>(interval);
+            }
+        }
+
+        index.sample_hash = sampleHash(code, index.checkpoints);
+        return index;
+    }
+
+    // Loads a saved index; returns false if it is missing, damaged or was built for other bytes.
+    bool load(const std::string& path, std::span<const u8> code, u64 modified) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        Header header;
+        bool ok = readAll(fd, &header, sizeof(header))
+            && std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0
+            && header.version == kVersion
+            && header.image_size == code.size()
+            && header.modified == modified
+            && header.interval != 0
+            && header.count <= code.size();
+
+        if (ok) {
+            checkpoints.resize(header.count);
+            ok = readAll(fd, checkpoints.data(), checkpoints.size() * sizeof(u64));
+        }
+        ::close(fd);
+
+        ok = ok && std::is_sorted(checkpoints.begin(), checkpoints.end())
+            && (checkpoints.empty() || checkpoints.back() < code.size())
+            && sampleHash(code, checkpoints) == header.sample_hash;
+        if (!ok) {
+            checkpoints.clear();
+            return false;
+        }
+
+        interval = header.interval;
+        image_size = header.image_size;
+        this->modified = header.modified;
+        sample_hash = header.sample_hash;
+        return true;
+    }
+
+    // Best effort: an index that cannot be written is simply rebuilt next time.
+    bool save(const std::string& path) const {
+        std::string temp = path + ".tmp";
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+
+        Header header{};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kVersion;
+        header.interval = interval;
+        header.image_size = image_size;
+        header.modified = modified;
+        header.sample_hash = sample_hash;
+        header.count = checkpoints.size();
+
+        bool ok = writeAll(fd, &header, sizeof(header)) && writeAll(fd, checkpoints.data(), checkpoints.size() * sizeof(u64));
+        ok = (::close(fd) == 0) && ok;
+        ok = ok && ::rename(temp.c_str(), path.c_str()) == 0;
+        if (!ok) ::unlink(temp.c_str());
+        return ok;
+    }
+
+    // Start of the first record at or after `offset`: the closest checkpoint
+    // below it, then record lengths up to it. Stops at a truncated record.
+    std::size_t boundaryAtOrAfter(std::span<const u8> code, std::size_t offset) const {
+        auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), offset);
+        if (it == checkpoints.begin()) return checkpoints.empty() ? code.size() : checkpoints.front();
+
+        std::size_t start = *std::prev(it);
+        LengthDecoder decoder(code.subspan(start), start);
+        std::array<std::size_t, 256> starts;
+
+        while (std::size_t count = decoder.boundaries(starts.data(), starts.size())) {
+            for (std::size_t i = 0; i < count; i++) {
+                if (starts[i] >= offset) return starts[i];
+            }
+        }
+
+        return start + decoder.position();
+    }
+
+    std::size_t size() const { return checkpoints.size(); }
+
+private:
+    static constexpr char kMagic[8] = {'S', '8', '6', 'C', 'K', 'P', 'T', '\0'};
+    static constexpr u32 kVersion = 1;
+
+    struct Header {
+        char magic[8];
+        u32 version;
+        u32 interval;
+        u64 image_size;
+        u64 modified;
+        u64 sample_hash;
+        u64 count;
+    };
+
+    u32 interval = kDefaultInterval;
+    u64 image_size = 0;
+    u64 modified = 0;
+    u64 sample_hash = 0;
+    std::vector<u64> checkpoints;
+
+    // FNV-1a over the bytes that decide each checkpoint's first record.
+    static u64 sampleHash(std::span<const u8> code, const std::vector<u64>& checkpoints) {
+        u64 hash = 0xcbf29ce484222325ull ^ code.size();
+        for (u64 checkpoint : checkpoints) {
+            std::size_t end = std::min<std::size_t>(checkpoint + kMaxInstructionLength, code.size());
+            for (std::size_t i = checkpoint; i < end; i++) {
+                hash = (hash ^ code[i]) * 0x100000001b3ull;
+            }
+        }
+        return hash;
+    }
+
+    static bool readAll(int fd, void* data, std::size_t size) {
+        auto* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t count = ::read(fd, bytes, size);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) return false;
+            bytes += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    static bool writeAll(int fd, const void* data, std::size_t size) {
+        auto* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t count = ::write(fd, bytes, size);
+            if (count < 0 && errno == EINTR) continue;
+            if (count < 0) return false;
+            bytes += count;
+            size -= count;
+        }
+        return true;
+    }
+};
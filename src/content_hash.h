@@ -0,0 +1,93 @@
+#pragma once
+
+#include <bit>
+#include <cstring>
+#include <span>
+
+#include "instruction.h"
+
+// XXH64: a non-cryptographic 64-bit hash that runs at memory speed, for
+// telling whole images apart. Four independent lanes over 32-byte stripes,
+// then the tail and a final avalanche, as in the reference implementation.
+class ContentHash {
+public:
+    static u64 of(std::span<const u8> data, u64 seed = 0) {
+        const u8* p = data.data();
+        const u8* end = p + data.size();
+        u64 hash;
+
+        if (data.size() >= 32) {
+            u64 v1 = seed + kPrime1 + kPrime2;
+            u64 v2 = seed + kPrime2;
+            u64 v3 = seed;
+            u64 v4 = seed - kPrime1;
+
+            for (; p + 32 <= end; p += 32) {
+                v1 = round(v1, read64(p));
+                v2 = round(v2, read64(p + 8));
+                v3 = round(v3, read64(p + 16));
+                v4 = round(v4, read64(p + 24));
+            }
+
+            hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+            hash = merge(hash, v1);
+            hash = merge(hash, v2);
+            hash = merge(hash, v3);
+            hash = merge(hash, v4);
+        } else {
+            hash = seed + kPrime5;
+        }
+
+        hash += data.size();
+
+        for (; p + 8 <= end; p += 8) {
+            hash ^= round(0, read64(p));
+            hash = std::rotl(hash, 27) * kPrime1 + kPrime4;
+        }
+        if (p + 4 <= end) {
+            hash ^= u64(read32(p)) * kPrime1;
+            hash = std::rotl(hash, 23) * kPrime2 + kPrime3;
+            p += 4;
+        }
+        for (; p < end; p++) {
+            hash ^= *p * kPrime5;
+            hash = std::rotl(hash, 11) * kPrime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= kPrime2;
+        hash ^= hash >> 29;
+        hash *= kPrime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+private:
+    static constexpr u64 kPrime1 = 0x9E3779B185EBCA87ull;
+    static constexpr u64 kPrime2 = 0xC2B2AE3D27D4EB4Full;
+    static constexpr u64 kPrime3 = 0x165667B19E3779F9ull;
+    static constexpr u64 kPrime4 = 0x85EBCA77C2B2AE63ull;
+    static constexpr u64 kPrime5 = 0x27D4EB2F165667C5ull;
+
+    static u64 round(u64 acc, u64 input) {
+        acc += input * kPrime2;
+        return std::rotl(acc, 31) * kPrime1;
+    }
+
+    static u64 merge(u64 hash, u64 lane) {
+        hash ^= round(0, lane);
+        return hash * kPrime1 + kPrime4;
+    }
+
+    static u64 read64(const u8* p) {
+        u64 value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static u32 read32(const u8* p) {
+        u32 value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "decoder.h"
+#include "instruction.h"
+
+struct BasicBlock {
+    std::size_t begin;      // offset of the first instruction
+    std::size_t end;        // offset just past the last instruction
+    std::size_t first;      // index of the first instruction in ControlFlowGraph::instructions
+    std::size_t count;
+    std::array<std::size_t, 2> successors;  // block indices; branch target first
+    u8 successor_count;
+};
+
+struct ControlFlowGraph {
+    static constexpr std::size_t kNoBlock = SIZE_MAX;
+
+    std::vector<DecodedInstruction> instructions;  // sorted by offset
+    std::vector<BasicBlock> blocks;                // sorted by begin
+    std::vector<std::size_t> truncated;            // offsets where a path ran past the end of the image
+
+    // Block starting exactly at `offset`, or kNoBlock.
+    std::size_t blockAt(std::size_t offset) const {
+        auto it = std::lower_bound(blocks.begin(), blocks.end(), offset,
+                                   [](const BasicBlock& block, std::size_t value) { return block.begin < value; });
+        return (it != blocks.end() && it->begin == offset) ? it - blocks.begin() : kNoBlock;
+    }
+};
+
+// Recursive-traversal disassembly. Starting from the entry points it decodes
+// straight-line runs and queues every relative branch and call target it
+// meets, so data that is never reached is never decoded. Each instruction
+// start is decoded once; a run stops as soon as it meets code already
+// decoded. Targets that land inside an earlier instruction are decoded as
+// their own, overlapping, instruction stream. Entry points, targets and
+// record offsets count from `origin`, the offset of code[0].
+class RecursiveDisassembler {
+public:
+    RecursiveDisassembler(std::span<const u8> code, std::size_t origin = 0) : code(code), origin(origin) {}
+
+    ControlFlowGraph run(std::span<const std::size_t> entry_points) {
+        ControlFlowGraph graph;
+        std::vector<bool> decoded(code.size());
+        std::vector<bool> leader(code.size());
+        std::vector<std::size_t> work;
+
+        for (std::size_t entry : entry_points) {
+            if (entry - origin < code.size()) queue(entry - origin, work, leader);
+        }
+
+        while (!work.empty()) {
+            std::size_t pc = work.back();
+            work.pop_back();
+            if (decoded[pc]) continue;
+
+            while (true) {
+                DecodedInstruction instr = InstructionDecoder::decodeOne(code, pc);
+                if (!instr.length) {
+                    graph.truncated.push_back(origin + pc);
+                    break;
+                }
+                instr.offset += origin;
+
+                decoded[pc] = true;
+                graph.instructions.push_back(instr);
+
+                ControlFlow flow = getControlFlow(instr);
+                if (flow == ControlFlow::Branch || flow == ControlFlow::Jump || flow == ControlFlow::Call) {
+                    std::size_t target = getBranchTarget(instr) - origin;
+                    if (target < code.size()) queue(target, work, leader);
+                }
+
+                pc += instr.length;
+                if (flow == ControlFlow::Stop || flow == ControlFlow::Jump || pc >= code.size()) break;
+
+                // Whatever follows a branch or call starts a block of its own.
+                if (flow != ControlFlow::Next) leader[pc] = true;
+                if (decoded[pc]) {
+                    leader[pc] = true;
+                    break;
+                }
+            }
+        }
+
+        std::sort(graph.instructions.begin(), graph.instructions.end(),
+                  [](const DecodedInstruction& a, const DecodedInstruction& b) { return a.offset < b.offset; });
+        std::sort(graph.truncated.begin(), graph.truncated.end());
+        buildBlocks(graph, leader);
+        return graph;
+    }
+
+private:
+    std::span<const u8> code;
+    std::size_t origin;
+
+    static void queue(std::size_t target, std::vector<std::size_t>& work, std::vector<bool>& leader) {
+        leader[target] = true;
+        work.push_back(target);
+    }
+
+    // Splits the sorted instructions at leaders, after control transfers and
+    // wherever the stream is not contiguous, then links the blocks.
+    void buildBlocks(ControlFlowGraph& graph, const std::vector<bool>& leader) const {
+        const auto& instructions = graph.instructions;
+
+        for (std::size_t i = 0; i < instructions.size(); i++) {
+            const DecodedInstruction& instr = instructions[i];
+            bool starts_block = i == 0 || leader[instr.offset - origin];
+            if (!starts_block) {
+                const DecodedInstruction& prev = instructions[i - 1];
+                starts_block = prev.offset + prev.length != instr.offset || getControlFlow(prev) != ControlFlow::Next;
+            }
+
+            if (starts_block) {
+                graph.blocks.push_back({instr.offset, instr.offset, i, 0, {}, 0});
+            }
+
+            BasicBlock& block = graph.blocks.back();
+            block.end = instr.offset + instr.length;
+            block.count++;
+        }
+
+        for (BasicBlock& block : graph.blocks) {
+            const DecodedInstruction& last = instructions[block.first + block.count - 1];
+            ControlFlow flow = getControlFlow(last);
+
+            auto link = [&graph, &block](std::size_t offset) {
+                std::size_t successor = graph.blockAt(offset);
+                if (successor != ControlFlowGraph::kNoBlock) block.successors[block.successor_count++] = successor;
+            };
+
+            if (flow == ControlFlow::Branch || flow == ControlFlow::Jump) link(getBranchTarget(last));
+            if (flow == ControlFlow::Next || flow == ControlFlow::Branch || flow == ControlFlow::Call) link(block.end);
+        }
+    }
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <array>
+#include <random>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "instruction.h"
+#include "length_decoder.h"
+#include "length_rules.h"
+#include "opcode_classifier.h"
+
+// Deterministic synthetic images for benchmarking and testing the decoder.
+// Every corpus ends on an instruction boundary, so it decodes without a
+// truncated tail.
+namespace Corpus {
+    constexpr std::string_view kNames[] = {"opcodes", "prefixes", "random", "mixed"};
+
+    // Appends the record that starts with `head` (opcode, maybe ModRM), with
+    // random bytes for whatever displacement and immediate it takes.
+    inline void appendInstruction(std::vector<u8>& image, std::initializer_list<u8> head, std::mt19937_64& rng) {
+        std::array<u8, kMaxInstructionLength> candidate;
+        for (u8& byte : candidate) byte = static_cast<u8>(rng());
+        std::copy(head.begin(), head.end(), candidate.begin());
+
+        std::size_t length = LengthDecoder::instructionLength(candidate, 0);
+        image.insert(image.end(), candidate.begin(), candidate.begin() + length);
+    }
+
+    // Every opcode, and for those with one every ModRM byte, over and over.
+    inline std::vector<u8> opcodes(std::size_t size, u64 seed = 1) {
+        std::mt19937_64 rng(seed);
+        std::vector<u8> image;
+
+        while (image.size() < size) {
+            for (int opcode = 0; opcode < 256; opcode++) {
+                if (isPrefixOpcode(opcode)) continue;
+                if (kLengthRules[opcode] & LengthRule::HasModRM) {
+                    for (int modrm = 0; modrm < 256; modrm++) appendInstruction(image, {u8(opcode), u8(modrm)}, rng);
+                } else {
+                    appendInstruction(image, {u8(opcode)}, rng);
+                }
+            }
+        }
+        return image;
+    }
+
+    // Instructions behind one to three prefixes, mostly in the order the
+    // decoder folds, sometimes repeated or out of order so they stand alone.
+    inline std::vector<u8> prefixes(std::size_t size, u64 seed = 2) {
+        constexpr u8 kRep[] = {0xF2, 0xF3};
+        constexpr u8 kSegment[] = {0x26, 0x2E, 0x36, 0x3E};
+        std::mt19937_64 rng(seed);
+        std::vector<u8> image;
+
+        while (image.size() < size) {
+            u64 choice = rng();
+            if (choice & 1) image.push_back(0xF0);
+            if (choice & 2) image.push_back(kRep[(choice >> 8) & 1]);
+            if ((choice & 4) || !(choice & 3)) image.push_back(kSegment[(choice >> 9) & 3]);
+            if ((choice & 0xF0) == 0) image.push_back(0xF0);
+
+            u8 opcode;
+            do opcode = static_cast<u8>(rng()); while (isPrefixOpcode(opcode));
+            appendInstruction(image, {opcode, static_cast<u8>(rng())}, rng);
+        }
+        return image;
+    }
+
+    // Uniform random bytes, cut at the last whole record.
+    inline std::vector<u8> random(std::size_t size, u64 seed = 3) {
+        std::mt19937_64 rng(seed);
+        std::vector<u8> image(size);
+        for (u8& byte : image) byte = static_cast<u8>(rng());
+
+        LengthDecoder decoder(image);
+        std::array<u8, 4096> lengths;
+        while (decoder.lengths(lengths.data(), lengths.size())) {}
+        image.resize(decoder.position());
+        return image;
+    }
+
+    // Compiler-like code: the opcode mix of typical 16-bit programs, with
+    // register and short-displacement forms most common.
+    inline std::vector<u8> mixed(std::size_t size, u64 seed = 4) {
+        struct Weight {
+            u8 first;
+            u8 last;
+            u32 weight;
+        };
+        constexpr Weight kMix[] = {
+            {0x88, 0x8B, 28}, {0x50, 0x5F, 12}, {0xB0, 0xBF, 9}, {0x00, 0x03, 4}, {0x28, 0x2B, 3},
+            {0x38, 0x3B, 5}, {0x30, 0x33, 3}, {0x83, 0x83, 6}, {0x40, 0x4F, 4}, {0x70, 0x7F, 8},
+            {0xE8, 0xE8, 5}, {0xEB, 0xEB, 3}, {0xC3, 0xC3, 2}, {0x8D, 0x8D, 2}, {0xD1, 0xD1, 2},
+            {0xA4, 0xAD, 1}, {0xCD, 0xCD, 1}, {0xF7, 0xF7, 1}, {0xFF, 0xFF, 1},
+        };
+        u32 total = 0;
+        for (const Weight& w : kMix) total += w.weight;
+
+        std::mt19937_64 rng(seed);
+        std::vector<u8> image;
+
+        while (image.size() < size) {
+            u32 pick = rng() % total;
+            const Weight* w = kMix;
+            while (pick >= w->weight) pick -= (w++)->weight;
+            u8 opcode = static_cast<u8>(w->first + rng() % (w->last - w->first + 1));
+
+            // mod 3 half the time, then disp8, then no displacement, then disp16.
+            static constexpr u8 kMod[] = {3, 3, 3, 3, 1, 1, 0, 2};
+            u8 modrm = static_cast<u8>(kMod[rng() % 8] << 6 | (rng() & 0x3F));
+            if (opcode == 0xA5 && (rng() & 1)) image.push_back(0xF3);
+            appendInstruction(image, {opcode, modrm}, rng);
+        }
+        return image;
+    }
+
+    // The named corpus, or an empty image for an unknown name.
+    inline std::vector<u8> make(std::string_view name, std::size_t size) {
+        if (name == "opcodes") return opcodes(size);
+        if (name == "prefixes") return prefixes(size);
+        if (name == "random") return random(size);
+        if (name == "mixed") return mixed(size);
+        return {};
+    }
+}
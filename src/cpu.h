@@ -0,0 +1,733 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+#include "instruction.h"
+
+namespace Flag {
+    constexpr u16 Carry = 1 << 0;
+    constexpr u16 Parity = 1 << 2;
+    constexpr u16 Auxiliary = 1 << 4;
+    constexpr u16 Zero = 1 << 6;
+    constexpr u16 Sign = 1 << 7;
+    constexpr u16 Trap = 1 << 8;
+    constexpr u16 Interrupt = 1 << 9;
+    constexpr u16 Direction = 1 << 10;
+    constexpr u16 Overflow = 1 << 11;
+
+    constexpr u16 All = Carry | Parity | Auxiliary | Zero | Sign | Trap | Interrupt | Direction | Overflow;
+}
+
+struct CpuState {
+    std::array<u16, 8> regs;  // ax, cx, dx, bx, sp, bp, si, di
+    std::array<u16, 4> segs;  // es, cs, ss, ds
+    u16 ip;
+    u16 flags;
+};
+
+// Executes 8086 code in a 1 MB address space. Each instruction is decoded
+// once, at its physical address, into a DecodedInstruction cache and run
+// from there on every later visit. Writes to bytes the cache was decoded
+// from drop the cache, so self-modifying code still sees its own stores.
+class Cpu {
+public:
+    static constexpr u32 kMemorySize = 1 << 20;
+
+    Cpu() : memory(kMemorySize), slots(kMemorySize), code_bits(kMemorySize / 64) {}
+
+    CpuState& state() { return registers; }
+    const CpuState& state() const { return registers; }
+
+    std::span<const u8> memoryView() const { return memory; }
+
+    // Copies `image` to `address`; running off its end halts the CPU.
+    void load(std::span<const u8> image, u32 address) {
+        if (image.size() > kMemorySize) throw std::runtime_error("[ERROR] Image does not fit in memory.");
+
+        for (std::size_t i = 0; i < image.size(); i++) {
+            memory[(address + i) & (kMemorySize - 1)] = image[i];
+        }
+        invalidate();
+        exit_address = (address + image.size()) & (kMemorySize - 1);
+    }
+
+    bool halted() const { return is_halted; }
+
+    // Executes one instruction; returns false once the CPU has halted.
+    bool step() {
+        if (is_halted) return false;
+
+        u32 address = physical(registers.segs[Cs], registers.ip);
+        if (address == exit_address) {
+            is_halted = true;
+            return false;
+        }
+
+        // A copy: executing may store into the code and drop the cache.
+        DecodedInstruction instr = fetch(address);
+        registers.ip += instr.length;
+        if (pending.prefixes) applyPending(instr);
+        if (instr.flags & InstructionFlags::PrefixOnly) {
+            pending = instr;
+            return true;
+        }
+        pending = {};
+        execute(instr);
+        return true;
+    }
+
+    // Runs until halted or `max_steps` instructions; returns how many ran.
+    std::size_t run(std::size_t max_steps = SIZE_MAX) {
+        std::size_t steps = 0;
+        while (steps < max_steps && step()) steps++;
+        return steps;
+    }
+
+    u8 read8(u32 address) const {
+        return memory[address & (kMemorySize - 1)];
+    }
+
+    u16 read16(u32 address) const {
+        return read8(address) | (read8(address + 1) << 8);
+    }
+
+    void write8(u32 address, u8 value) {
+        address &= kMemorySize - 1;
+        memory[address] = value;
+        if ((code_bits[address / 64] >> (address % 64)) & 1) invalidate();
+    }
+
+    void write16(u32 address, u16 value) {
+        write8(address, value & 0xFF);
+        write8(address + 1, value >> 8);
+    }
+
+private:
+    enum : u8 { Ax, Cx, Dx, Bx, Sp, Bp, Si, Di };
+    enum : u8 { Es, Cs, Ss, Ds };
+
+    CpuState registers{};
+    bool is_halted = false;
+    // Prefixes the decoder left in records of their own, for the next instruction.
+    DecodedInstruction pending{};
+    u32 exit_address = kMemorySize;
+
+    std::vector<u8> memory;
+    std::vector<u32> slots;  // cache index + 1 for each physical address, 0 when not decoded
+    std::vector<u64> code_bits;
+    std::vector<DecodedInstruction> cache;
+
+    static u32 physical(u16 segment, u16 offset) {
+        return ((static_cast<u32>(segment) << 4) + offset) & (kMemorySize - 1);
+    }
+
+    const DecodedInstruction& fetch(u32 address) {
+        if (u32 slot = slots[address]) return cache[slot - 1];
+
+        Truncation truncation{};
+        DecodedInstruction instr = InstructionDecoder::decodeOne(memory, address, &truncation);
+        if (!instr.length) throw truncatedInstruction(truncation);
+
+        for (std::size_t i = address; i < address + instr.length; i++) {
+            code_bits[i / 64] |= u64(1) << (i % 64);
+        }
+        cache.push_back(instr);
+        slots[address] = static_cast<u32>(cache.size());
+        return cache.back();
+    }
+
+    void invalidate() {
+        for (const DecodedInstruction& instr : cache) slots[instr.offset] = 0;
+        cache.clear();
+        std::fill(code_bits.begin(), code_bits.end(), 0);
+    }
+
+    [[noreturn]] static void unsupported(const DecodedInstruction& instr) {
+        throw std::runtime_error("[ERROR] Cannot execute instruction at position " + std::to_string(instr.offset) + ".");
+    }
+
+    // Flags
+
+    bool flag(u16 mask) const { return registers.flags & mask; }
+
+    void setFlag(u16 mask, bool value) {
+        registers.flags = value ? (registers.flags | mask) : (registers.flags & ~mask);
+    }
+
+    void setResultFlags(u32 result, bool wide) {
+        u32 sign = wide ? 0x8000 : 0x80;
+        setFlag(Flag::Zero, (result & (wide ? 0xFFFF : 0xFF)) == 0);
+        setFlag(Flag::Sign, result & sign);
+        setFlag(Flag::Parity, !__builtin_parity(result & 0xFF));
+    }
+
+    bool condition(Operation operation) const {
+        bool cf = flag(Flag::Carry), zf = flag(Flag::Zero), sf = flag(Flag::Sign);
+        bool of = flag(Flag::Overflow), pf = flag(Flag::Parity);
+
+        switch (operation) {
+            case Operation::Jo: return of;
+            case Operation::Jno: return !of;
+            case Operation::Jb: return cf;
+            case Operation::Jnb: return !cf;
+            case Operation::Je: return zf;
+            case Operation::Jne: return !zf;
+            case Operation::Jbe: return cf || zf;
+            case Operation::Jnbe: return !cf && !zf;
+            case Operation::Js: return sf;
+            case Operation::Jns: return !sf;
+            case Operation::Jp: return pf;
+            case Operation::Jnp: return !pf;
+            case Operation::Jl: return sf != of;
+            case Operation::Jnl: return sf == of;
+            case Operation::Jle: return zf || sf != of;
+            default: return !zf && sf == of;
+        }
+    }
+
+    // Registers and operands
+
+    u16 getRegister(Register reg) const {
+        u8 index = static_cast<u8>(reg);
+        if (index < 8) {
+            u16 value = registers.regs[index & 3];
+            return (index < 4) ? (value & 0xFF) : (value >> 8);
+        }
+        return (index < 16) ? registers.regs[index - 8] : registers.segs[index - 16];
+    }
+
+    void setRegister(Register reg, u16 value) {
+        u8 index = static_cast<u8>(reg);
+        if (index < 8) {
+            u16& full = registers.regs[index & 3];
+            full = (index < 4) ? ((full & 0xFF00) | (value & 0xFF)) : ((full & 0x00FF) | (value << 8));
+        } else if (index < 16) {
+            registers.regs[index - 8] = value;
+        } else {
+            registers.segs[index - 16] = value;
+        }
+    }
+
+    u16 effectiveOffset(const DecodedInstruction& instr, EffectiveAddress ea) const {
+        const auto& r = registers.regs;
+        u16 disp = static_cast<u16>(instr.displacement);
+
+        switch (ea) {
+            case EffectiveAddress::BxSi: return r[Bx] + r[Si] + disp;
+            case EffectiveAddress::BxDi: return r[Bx] + r[Di] + disp;
+            case EffectiveAddress::BpSi: return r[Bp] + r[Si] + disp;
+            case EffectiveAddress::BpDi: return r[Bp] + r[Di] + disp;
+            case EffectiveAddress::Si: return r[Si] + disp;
+            case EffectiveAddress::Di: return r[Di] + disp;
+            case EffectiveAddress::Bp: return r[Bp] + disp;
+            case EffectiveAddress::Bx: return r[Bx] + disp;
+            case EffectiveAddress::Direct: return disp;
+        }
+        return disp;
+    }
+
+    // The decoder folds prefixes only in lock, rep, segment order, so `es rep
+    // movsb` arrives as a prefix-only `es` record and `rep movsb`. The CPU
+    // takes prefixes in any order, a later one of the same group winning.
+    void applyPending(DecodedInstruction& instr) const {
+        u8 inherited = pending.prefixes;
+        if (instr.prefixes & (Prefix::Rep | Prefix::Repne)) inherited &= ~(Prefix::Rep | Prefix::Repne);
+        if (instr.prefixes & Prefix::Segment) {
+            inherited &= ~Prefix::Segment;
+        } else if (inherited & Prefix::Segment) {
+            instr.segment = pending.segment;
+        }
+        instr.prefixes |= inherited;
+    }
+
+    // Segment used for data: an override prefix, else `fallback`.
+    u16 dataSegment(const DecodedInstruction& instr, u8 fallback) const {
+        if (instr.prefixes & Prefix::Segment) return getRegister(instr.segment);
+        return registers.segs[fallback];
+    }
+
+    u32 memoryAddress(const DecodedInstruction& instr, EffectiveAddress ea, u16 extra = 0) const {
+        bool stack = ea == EffectiveAddress::BpSi || ea == EffectiveAddress::BpDi || ea == EffectiveAddress::Bp;
+        return physical(dataSegment(instr, stack ? Ss : Ds), effectiveOffset(instr, ea) + extra);
+    }
+
+    u16 read(const DecodedInstruction& instr, Operand operand) const {
+        switch (operand.kind) {
+            case OperandKind::Register:
+                return getRegister(static_cast<Register>(operand.value));
+            case OperandKind::Memory: {
+                u32 address = memoryAddress(instr, static_cast<EffectiveAddress>(operand.value));
+                return (instr.flags & InstructionFlags::Wide) ? read16(address) : read8(address);
+            }
+            default:
+                return instr.immediate;
+        }
+    }
+
+    void write(const DecodedInstruction& instr, Operand operand, u16 value) {
+        if (operand.kind == OperandKind::Register) {
+            setRegister(static_cast<Register>(operand.value), value);
+        } else {
+            u32 address = memoryAddress(instr, static_cast<EffectiveAddress>(operand.value));
+            if (instr.flags & InstructionFlags::Wide) {
+                write16(address, value);
+            } else {
+                write8(address, static_cast<u8>(value));
+            }
+        }
+    }
+
+    void push(u16 value) {
+        registers.regs[Sp] -= 2;
+        write16(physical(registers.segs[Ss], registers.regs[Sp]), value);
+    }
+
+    u16 pop() {
+        u16 value = read16(physical(registers.segs[Ss], registers.regs[Sp]));
+        registers.regs[Sp] += 2;
+        return value;
+    }
+
+    void interrupt(u8 vector) {
+        push(registers.flags | 0xF002);
+        setFlag(Flag::Interrupt | Flag::Trap, false);
+        push(registers.segs[Cs]);
+        push(registers.ip);
+        registers.ip = read16(vector * 4);
+        registers.segs[Cs] = read16(vector * 4 + 2);
+    }
+
+    // Arithmetic
+
+    u16 arithmetic(Operation operation, u32 a, u32 b, bool wide) {
+        u32 mask = wide ? 0xFFFF : 0xFF;
+        u32 sign = wide ? 0x8000 : 0x80;
+        u32 result;
+
+        switch (operation) {
+            case Operation::Add:
+            case Operation::Adc: {
+                u32 carry = operation == Operation::Adc && flag(Flag::Carry);
+                result = a + b + carry;
+                setFlag(Flag::Carry, result > mask);
+                setFlag(Flag::Overflow, (a ^ result) & (b ^ result) & sign);
+                setFlag(Flag::Auxiliary, (a ^ b ^ result) & 0x10);
+                break;
+            }
+            case Operation::Sub:
+            case Operation::Sbb:
+            case Operation::Cmp: {
+                u32 borrow = operation == Operation::Sbb && flag(Flag::Carry);
+                result = a - b - borrow;
+                setFlag(Flag::Carry, a < b + borrow);
+                setFlag(Flag::Overflow, (a ^ b) & (a ^ result) & sign);
+                setFlag(Flag::Auxiliary, (a ^ b ^ result) & 0x10);
+                break;
+            }
+            default:
+                result = (operation == Operation::Or) ? (a | b) : (operation == Operation::Xor) ? (a ^ b) : (a & b);
+                setFlag(Flag::Carry | Flag::Overflow | Flag::Auxiliary, false);
+                break;
+        }
+
+        setResultFlags(result, wide);
+        return static_cast<u16>(result & mask);
+    }
+
+    u16 shift(Operation operation, u32 value, u8 count, bool wide) {
+        if (count == 0) return static_cast<u16>(value);
+
+        u32 mask = wide ? 0xFFFF : 0xFF;
+        u32 sign = wide ? 0x8000 : 0x80;
+        bool carry = flag(Flag::Carry);
+        u32 previous = value;
+
+        for (u8 i = 0; i < count; i++) {
+            previous = value;
+            switch (operation) {
+                case Operation::Rol:
+                    carry = value & sign;
+                    value = ((value << 1) | carry) & mask;
+                    break;
+                case Operation::Ror:
+                    carry = value & 1;
+                    value = (value >> 1) | (carry ? sign : 0);
+                    break;
+                case Operation::Rcl: {
+                    bool out = value & sign;
+                    value = ((value << 1) | carry) & mask;
+                    carry = out;
+                    break;
+                }
+                case Operation::Rcr: {
+                    bool out = value & 1;
+                    value = (value >> 1) | (carry ? sign : 0);
+                    carry = out;
+                    break;
+                }
+                case Operation::Sal:
+                    carry = value & sign;
+                    value = (value << 1) & mask;
+                    break;
+                case Operation::Shr:
+                    carry = value & 1;
+                    value >>= 1;
+                    break;
+                default:
+                    carry = value & 1;
+                    value = (value >> 1) | (value & sign);
+                    break;
+            }
+        }
+
+        // For every form, OF is whether the last step changed the sign bit.
+        setFlag(Flag::Carry, carry);
+        setFlag(Flag::Overflow, (previous ^ value) & sign);
+        if (operation >= Operation::Sal) setResultFlags(value, wide);
+        return static_cast<u16>(value);
+    }
+
+    void multiply(const DecodedInstruction& instr, bool is_signed) {
+        auto& r = registers.regs;
+        bool wide = instr.flags & InstructionFlags::Wide;
+        u16 source = read(instr, instr.operands[0]);
+        bool high;
+
+        if (wide) {
+            u32 product = is_signed ? static_cast<u32>(static_cast<i16>(r[Ax]) * static_cast<i16>(source)) : u32(r[Ax]) * source;
+            r[Ax] = static_cast<u16>(product);
+            r[Dx] = static_cast<u16>(product >> 16);
+            high = is_signed ? (r[Dx] != ((r[Ax] & 0x8000) ? 0xFFFF : 0)) : r[Dx] != 0;
+        } else {
+            u16 product = is_signed ? static_cast<u16>(static_cast<i8>(r[Ax]) * static_cast<i8>(source)) : u16((r[Ax] & 0xFF) * (source & 0xFF));
+            r[Ax] = product;
+            high = is_signed ? ((product >> 8) != ((product & 0x80) ? 0xFF : 0)) : (product >> 8) != 0;
+        }
+
+        setFlag(Flag::Carry | Flag::Overflow, high);
+    }
+
+    // Divide overflow raises interrupt 0, as on the CPU.
+    void divide(const DecodedInstruction& instr, bool is_signed) {
+        auto& r = registers.regs;
+        bool wide = instr.flags & InstructionFlags::Wide;
+        u16 source = read(instr, instr.operands[0]);
+
+        if (wide) {
+            u32 dividend = (u32(r[Dx]) << 16) | r[Ax];
+            if (source == 0) return interrupt(0);
+            if (is_signed) {
+                int64_t quotient = int64_t(static_cast<int32_t>(dividend)) / static_cast<i16>(source);
+                if (quotient > 0x7FFF || quotient < -0x7FFF) return interrupt(0);
+                r[Dx] = static_cast<u16>(static_cast<int32_t>(dividend) % static_cast<i16>(source));
+                r[Ax] = static_cast<u16>(quotient);
+            } else {
+                u32 quotient = dividend / source;
+                if (quotient > 0xFFFF) return interrupt(0);
+                r[Dx] = static_cast<u16>(dividend % source);
+                r[Ax] = static_cast<u16>(quotient);
+            }
+        } else {
+            u16 dividend = r[Ax];
+            u8 divisor = source & 0xFF;
+            if (divisor == 0) return interrupt(0);
+            if (is_signed) {
+                int quotient = static_cast<i16>(dividend) / static_cast<i8>(divisor);
+                if (quotient > 0x7F || quotient < -0x7F) return interrupt(0);
+                u8 remainder = static_cast<u8>(static_cast<i16>(dividend) % static_cast<i8>(divisor));
+                r[Ax] = static_cast<u16>((remainder << 8) | static_cast<u8>(quotient));
+            } else {
+                u16 quotient = dividend / divisor;
+                if (quotient > 0xFF) return interrupt(0);
+                r[Ax] = static_cast<u16>(((dividend % divisor) << 8) | quotient);
+            }
+        }
+    }
+
+    void decimalAdjust(const DecodedInstruction& instr) {
+        auto& r = registers.regs;
+        u8 al = r[Ax] & 0xFF;
+        bool cf = flag(Flag::Carry);
+        bool low = (al & 0xF) > 9 || flag(Flag::Auxiliary);
+
+        switch (instr.operation) {
+            case Operation::Daa:
+            case Operation::Das: {
+                bool add = instr.operation == Operation::Daa;
+                u8 result = al;
+                if (low) result = add ? result + 6 : result - 6;
+                bool high = al > 0x99 || cf;
+                if (high) result = add ? result + 0x60 : result - 0x60;
+                setFlag(Flag::Auxiliary, low);
+                setFlag(Flag::Carry, high);
+                setResultFlags(result, false);
+                r[Ax] = (r[Ax] & 0xFF00) | result;
+                break;
+            }
+            case Operation::Aaa:
+            case Operation::Aas: {
+                bool add = instr.operation == Operation::Aaa;
+                u8 ah = r[Ax] >> 8;
+                if (low) {
+                    al = add ? al + 6 : al - 6;
+                    ah = add ? ah + 1 : ah - 1;
+                }
+                r[Ax] = static_cast<u16>((ah << 8) | (al & 0x0F));
+                setFlag(Flag::Auxiliary | Flag::Carry, low);
+                break;
+            }
+            case Operation::Aam: {
+                u8 base = static_cast<u8>(instr.immediate);
+                if (base == 0) return interrupt(0);
+                r[Ax] = static_cast<u16>(((al / base) << 8) | (al % base));
+                setResultFlags(r[Ax] & 0xFF, false);
+                break;
+            }
+            default: {
+                u8 base = static_cast<u8>(instr.immediate);
+                u8 result = static_cast<u8>(al + (r[Ax] >> 8) * base);
+                r[Ax] = result;
+                setResultFlags(result, false);
+                break;
+            }
+        }
+    }
+
+    void stringOperation(const DecodedInstruction& instr) {
+        auto& r = registers.regs;
+        bool wide = instr.flags & InstructionFlags::Wide;
+        bool repeat = instr.prefixes & (Prefix::Rep | Prefix::Repne);
+        i16 delta = static_cast<i16>((wide ? 2 : 1) * (flag(Flag::Direction) ? -1 : 1));
+        u16 source_segment = dataSegment(instr, Ds);
+
+        if (repeat && r[Cx] == 0) return;
+
+        while (true) {
+            u32 source = physical(source_segment, r[Si]);
+            u32 destination = physical(registers.segs[Es], r[Di]);
+            u16 accumulator = wide ? r[Ax] : (r[Ax] & 0xFF);
+
+            switch (instr.operation) {
+                case Operation::Movs:
+                    if (wide) write16(destination, read16(source)); else write8(destination, read8(source));
+                    r[Si] += delta;
+                    r[Di] += delta;
+                    break;
+                case Operation::Cmps:
+                    arithmetic(Operation::Cmp, wide ? read16(source) : read8(source), wide ? read16(destination) : read8(destination), wide);
+                    r[Si] += delta;
+                    r[Di] += delta;
+                    break;
+                case Operation::Stos:
+                    if (wide) write16(destination, accumulator); else write8(destination, static_cast<u8>(accumulator));
+                    r[Di] += delta;
+                    break;
+                case Operation::Lods:
+                    setRegister(wide ? Register::Ax : Register::Al, wide ? read16(source) : read8(source));
+                    r[Si] += delta;
+                    break;
+                default:
+                    arithmetic(Operation::Cmp, accumulator, wide ? read16(destination) : read8(destination), wide);
+                    r[Di] += delta;
+                    break;
+            }
+
+            if (!repeat || --r[Cx] == 0) return;
+
+            if (instr.operation == Operation::Cmps || instr.operation == Operation::Scas) {
+                bool zf = flag(Flag::Zero);
+                if ((instr.prefixes & Prefix::Rep) ? !zf : zf) return;
+            }
+        }
+    }
+
+    void jumpFar(u16 segment, u16 offset) {
+        registers.segs[Cs] = segment;
+        registers.ip = offset;
+    }
+
+    void execute(const DecodedInstruction& instr) {
+        auto& r = registers.regs;
+        const Operand& dst = instr.operands[0];
+        const Operand& src = instr.operands[1];
+        bool wide = instr.flags & InstructionFlags::Wide;
+
+        switch (instr.operation) {
+            case Operation::Mov:
+                write(instr, dst, read(instr, src));
+                break;
+            case Operation::Add: case Operation::Or: case Operation::Adc: case Operation::Sbb:
+            case Operation::And: case Operation::Sub: case Operation::Xor:
+                write(instr, dst, arithmetic(instr.operation, read(instr, dst), read(instr, src), wide));
+                break;
+            case Operation::Cmp:
+                arithmetic(Operation::Cmp, read(instr, dst), read(instr, src), wide);
+                break;
+            case Operation::Test:
+                arithmetic(Operation::And, read(instr, dst), read(instr, src), wide);
+                break;
+            case Operation::Inc:
+            case Operation::Dec: {
+                bool carry = flag(Flag::Carry);
+                write(instr, dst, arithmetic(instr.operation == Operation::Inc ? Operation::Add : Operation::Sub, read(instr, dst), 1, wide));
+                setFlag(Flag::Carry, carry);
+                break;
+            }
+            case Operation::Not:
+                write(instr, dst, ~read(instr, dst));
+                break;
+            case Operation::Neg:
+                write(instr, dst, arithmetic(Operation::Sub, 0, read(instr, dst), wide));
+                break;
+            case Operation::Mul: multiply(instr, false); break;
+            case Operation::Imul: multiply(instr, true); break;
+            case Operation::Div: divide(instr, false); break;
+            case Operation::Idiv: divide(instr, true); break;
+            case Operation::Rol: case Operation::Ror: case Operation::Rcl: case Operation::Rcr:
+            case Operation::Sal: case Operation::Shr: case Operation::Sar:
+                write(instr, dst, shift(instr.operation, read(instr, dst), static_cast<u8>(read(instr, src)), wide));
+                break;
+            case Operation::Xchg: {
+                u16 a = read(instr, dst);
+                write(instr, dst, read(instr, src));
+                write(instr, src, a);
+                break;
+            }
+            case Operation::Lea:
+                write(instr, dst, effectiveOffset(instr, static_cast<EffectiveAddress>(src.value)));
+                break;
+            case Operation::Les:
+            case Operation::Lds: {
+                u32 address = memoryAddress(instr, static_cast<EffectiveAddress>(src.value));
+                write(instr, dst, read16(address));
+                registers.segs[instr.operation == Operation::Les ? Es : Ds] = read16(memoryAddress(instr, static_cast<EffectiveAddress>(src.value), 2));
+                break;
+            }
+            case Operation::Push:
+                // push sp stores the already decremented value.
+                if (dst.kind == OperandKind::Register && static_cast<Register>(dst.value) == Register::Sp) {
+                    push(r[Sp] - 2);
+                } else {
+                    push(read(instr, dst));
+                }
+                break;
+            case Operation::Pop:
+                write(instr, dst, pop());
+                break;
+            case Operation::Pushf: push(registers.flags | 0xF002); break;
+            case Operation::Popf: registers.flags = pop() & Flag::All; break;
+            case Operation::Sahf: registers.flags = (registers.flags & 0xFF00) | ((r[Ax] >> 8) & Flag::All & 0xFF); break;
+            case Operation::Lahf: r[Ax] = static_cast<u16>((r[Ax] & 0x00FF) | ((registers.flags & 0xFF) | 0x02) << 8); break;
+            case Operation::Cbw: r[Ax] = static_cast<u16>(static_cast<i8>(r[Ax] & 0xFF)); break;
+            case Operation::Cwd: r[Dx] = (r[Ax] & 0x8000) ? 0xFFFF : 0; break;
+            case Operation::Xlat:
+                setRegister(Register::Al, read8(physical(dataSegment(instr, Ds), r[Bx] + (r[Ax] & 0xFF))));
+                break;
+            case Operation::Daa: case Operation::Das: case Operation::Aaa: case Operation::Aas:
+            case Operation::Aam: case Operation::Aad:
+                decimalAdjust(instr);
+                break;
+            case Operation::Clc: setFlag(Flag::Carry, false); break;
+            case Operation::Stc: setFlag(Flag::Carry, true); break;
+            case Operation::Cmc: setFlag(Flag::Carry, !flag(Flag::Carry)); break;
+            case Operation::Cli: setFlag(Flag::Interrupt, false); break;
+            case Operation::Sti: setFlag(Flag::Interrupt, true); break;
+            case Operation::Cld: setFlag(Flag::Direction, false); break;
+            case Operation::Std: setFlag(Flag::Direction, true); break;
+            case Operation::Movs: case Operation::Cmps: case Operation::Stos:
+            case Operation::Lods: case Operation::Scas:
+                stringOperation(instr);
+                break;
+            case Operation::In:
+                // No devices are attached; the bus reads as all ones.
+                write(instr, dst, 0xFFFF);
+                break;
+            case Operation::Out: case Operation::Wait: case Operation::Esc:
+                break;
+            case Operation::Hlt:
+                is_halted = true;
+                break;
+            case Operation::Int: interrupt(static_cast<u8>(instr.immediate)); break;
+            case Operation::Int3: interrupt(3); break;
+            case Operation::Into: if (flag(Flag::Overflow)) interrupt(4); break;
+            case Operation::Iret:
+                registers.ip = pop();
+                registers.segs[Cs] = pop();
+                registers.flags = pop() & Flag::All;
+                break;
+            case Operation::Ret:
+                registers.ip = pop();
+                if (dst.kind != OperandKind::None) r[Sp] += instr.immediate;
+                break;
+            case Operation::Retf:
+                registers.ip = pop();
+                registers.segs[Cs] = pop();
+                if (dst.kind != OperandKind::None) r[Sp] += instr.immediate;
+                break;
+            case Operation::Jmp:
+                if (dst.kind == OperandKind::Relative) {
+                    registers.ip += instr.displacement;
+                } else if (dst.kind == OperandKind::Far) {
+                    jumpFar(instr.immediate, static_cast<u16>(instr.displacement));
+                } else {
+                    registers.ip = read(instr, dst);
+                }
+                break;
+            case Operation::Call:
+                if (dst.kind == OperandKind::Relative) {
+                    push(registers.ip);
+                    registers.ip += instr.displacement;
+                } else if (dst.kind == OperandKind::Far) {
+                    push(registers.segs[Cs]);
+                    push(registers.ip);
+                    jumpFar(instr.immediate, static_cast<u16>(instr.displacement));
+                } else {
+                    u16 target = read(instr, dst);
+                    push(registers.ip);
+                    registers.ip = target;
+                }
+                break;
+            case Operation::JmpFar:
+            case Operation::CallFar: {
+                if (dst.kind != OperandKind::Memory) unsupported(instr);
+                u32 address = memoryAddress(instr, static_cast<EffectiveAddress>(dst.value));
+                u16 offset = read16(address);
+                u16 segment = read16(memoryAddress(instr, static_cast<EffectiveAddress>(dst.value), 2));
+                if (instr.operation == Operation::CallFar) {
+                    push(registers.segs[Cs]);
+                    push(registers.ip);
+                }
+                jumpFar(segment, offset);
+                break;
+            }
+            case Operation::Loopne: case Operation::Loope: case Operation::Loop: {
+                bool taken = --r[Cx] != 0;
+                if (instr.operation == Operation::Loope) taken = taken && flag(Flag::Zero);
+                if (instr.operation == Operation::Loopne) taken = taken && !flag(Flag::Zero);
+                if (taken) registers.ip += instr.displacement;
+                break;
+            }
+            case Operation::Jcxz:
+                if (r[Cx] == 0) registers.ip += instr.displacement;
+                break;
+            case Operation::None:
+                unsupported(instr);
+                break;
+            case Operation::Unknown:
+            case Operation::Count:
+                unsupported(instr);
+            default:
+                if (instr.operation >= Operation::Jo && instr.operation <= Operation::Jnle) {
+                    if (condition(instr.operation)) registers.ip += instr.displacement;
+                    break;
+                }
+                unsupported(instr);
+        }
+    }
+};
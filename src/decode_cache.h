@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "content_hash.h"
+#include "input.h"
+#include "instruction.h"
+#include "output_buffer.h"
+
+// Directory of finished decoder output, one entry per image content and
+// output variant (text, labels, timing, binary records). An entry is found
+// by the XXH64 hash of the image, so a renamed or copied file still hits and
+// an edited one misses. A hit maps the entry and writes it out without
+// decoding. Entries carry the image size and a hash of their own payload;
+// one that does not match is treated as a miss and overwritten.
+class DecodeCache {
+public:
+    struct Key {
+        u64 content_hash;
+        u64 image_size;
+        u32 variant;
+    };
+
+    DecodeCache(std::string directory) : directory(std::move(directory)) {}
+
+    // `variant` distinguishes outputs of the same image made with different options.
+    static Key key(std::span<const u8> code, u32 variant) {
+        return {ContentHash::of(code), code.size(), variant};
+    }
+
+    // Writes the cached output for `key` to `output`; false if there is no valid entry.
+    bool load(const Key& key, OutputBuffer& output) const {
+        std::optional<InputFile> entry;
+        try {
+            entry.emplace(entryPath(key));
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+
+        std::span<const u8> bytes = entry->bytes();
+        if (bytes.size() < sizeof(Header)) return false;
+
+        Header header;
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        std::span<const u8> payload = bytes.subspan(sizeof(header));
+
+        bool valid = std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0
+            && header.version == kVersion
+            && header.variant == key.variant
+            && header.image_size == key.image_size
+            && header.content_hash == key.content_hash
+            && header.output_size == payload.size()
+            && header.output_hash == ContentHash::of(payload);
+        if (!valid) return false;
+
+        output.append({reinterpret_cast<const char*>(payload.data()), payload.size()});
+        return true;
+    }
+
+    // Best effort, like the checkpoint index: a failed store only costs a later decode.
+    bool store(const Key& key, std::string_view text) const {
+        ::mkdir(directory.c_str(), 0755);
+
+        std::string path = entryPath(key);
+        std::string temp = path + ".tmp." + std::to_string(::getpid());
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+
+        Header header{};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kVersion;
+        header.variant = key.variant;
+        header.image_size = key.image_size;
+        header.content_hash = key.content_hash;
+        header.output_size = text.size();
+        header.output_hash = ContentHash::of({reinterpret_cast<const u8*>(text.data()), text.size()});
+
+        bool ok = writeAll(fd, &header, sizeof(header)) && writeAll(fd, text.data(), text.size());
+        ok = (::close(fd) == 0) && ok;
+        ok = ok && ::rename(temp.c_str(), path.c_str()) == 0;
+        if (!ok) ::unlink(temp.c_str());
+        return ok;
+    }
+
+private:
+    static constexpr char kMagic[8] = {'S', '8', '6', 'C', 'A', 'C', 'H', 'E'};
+    static constexpr u32 kVersion = 2;   // 2: binary output records the image origin
+
+    struct Header {
+        char magic[8];
+        u32 version;
+        u32 variant;
+        u64 image_size;
+        u64 content_hash;
+        u64 output_size;
+        u64 output_hash;
+    };
+
+    std::string directory;
+
+    std::string entryPath(const Key& key) const {
+        char name[40];
+        std::snprintf(name, sizeof(name), "/%016llx-%x.s86c", static_cast<unsigned long long>(key.content_hash), key.variant);
+        return directory + name;
+    }
+
+    static bool writeAll(int fd, const void* data, std::size_t size) {
+        auto* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t count = ::write(fd, bytes, size);
+            if (count < 0 && errno == EINTR) continue;
+            if (count < 0) return false;
+            bytes += count;
+            size -= count;
+        }
+        return true;
+    }
+};
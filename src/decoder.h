@@ -0,0 +1,635 @@
+#pragma once
+
+#include <span>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <stdexcept>
+#include <string>
+
+#include "instruction.h"
+#include "instrumentation.h"
+#include "opcode_classifier.h"
+#include "opcode_table.h"
+
+// An instruction cut off by the end of the input.
+struct Truncation {
+    std::size_t offset;  // where it starts
+    u8 opcode;
+    u8 needed;           // its length were the missing bytes zero
+    u8 available;        // bytes the input had left
+};
+
+// Decodes 8086 machine code into DecodedInstruction records. A decoder holds
+// only its position in one input, so each thread uses its own; decodeOne()
+// keeps no state at all. Nothing here throws: an instruction that runs past
+// the end of the input stops decoding and is described by truncation().
+//
+// Handlers read without bounds checks. While a whole instruction fits in
+// what is left they read the input itself; the last few bytes are copied
+// into a zero-padded buffer first, and a record that turns out longer than
+// the bytes really left is the truncated one.
+class InstructionDecoder {
+public:
+    // `origin` is the input offset of code[0], so records carry absolute offsets.
+    // A non-final window stops once a whole instruction might not fit in it;
+    // position() then tells the caller how much was consumed.
+    InstructionDecoder(std::span<const u8> code, std::size_t origin = 0, bool final = true)
+        : code(code), origin(origin), runs(code) {
+        // A non-final window too short for one whole instruction decodes nothing.
+        limit = final ? code.size() : code.size() - std::min(code.size(), kMaxInstructionLength - 1);
+    }
+
+    // Decodes the instruction at `offset` of `code`. The record's length is 0
+    // when the instruction runs past the end of `code`; `truncation`, if
+    // given, then says how far.
+    static DecodedInstruction decodeOne(std::span<const u8> code, std::size_t offset, Truncation* truncation = nullptr) {
+        DecodedInstruction instr{};
+        instr.offset = offset;
+        if (offset >= code.size()) {
+            if (truncation) *truncation = {offset, 0, 1, 0};
+            return instr;
+        }
+
+        InstructionDecoder decoder(code);
+        decoder.pc = offset;
+        if (!decoder.decodeAt(instr)) {
+            instr = {};
+            instr.offset = offset;
+            if (truncation) *truncation = decoder.cut;
+        }
+        return instr;
+    }
+
+    // Decodes up to `capacity` instructions from the current position into `out`.
+    // Returns the number of records written, 0 once the input is exhausted or
+    // the next instruction is truncated.
+    std::size_t decode(DecodedInstruction* out, std::size_t capacity) {
+        std::size_t count = 0;
+        while (count < capacity && pc < limit && !is_truncated) {
+            // Runs of one-byte instructions are copied from per-opcode templates.
+            if (isOneByteOpcode(code[pc])) {
+                std::size_t run = runs.oneByteRun(pc, std::min(capacity - count, limit - pc));
+                const auto& templates = getOneByteTemplates();
+                INSTRUMENT_ONLY(Instrumentation::local().one_byte_run_records += run);
+                for (std::size_t i = 0; i < run; i++, pc++) {
+                    INSTRUMENT_ONLY(Instrumentation::local().opcodes[code[pc]]++);
+                    INSTRUMENT_ONLY(Instrumentation::local().unknown_opcodes += templates[code[pc]].operation == Operation::Unknown);
+                    out[count] = templates[code[pc]];
+                    out[count++].offset = origin + pc;
+                }
+                continue;
+            }
+
+            if (!decodeAt(out[count])) break;
+            count++;
+        }
+        return count;
+    }
+
+    bool done() const { return pc >= limit || is_truncated; }
+
+    // True once decoding stopped at an instruction that runs past the end of
+    // the input; position() is then where it starts.
+    bool truncated() const { return is_truncated; }
+
+    // The instruction decoding stopped at, when truncated().
+    const Truncation& truncation() const { return cut; }
+
+    std::size_t position() const { return pc; }
+
+private:
+    std::span<const u8> code;
+    std::size_t origin;
+    std::size_t limit;
+    std::size_t pc = 0;
+    bool is_truncated = false;
+    Truncation cut{};
+    OpcodeRuns runs;
+
+    struct ModRM {
+        u8 mod;
+        u8 reg;
+        u8 rm;
+    };
+
+    // Decodes the record at pc; returns false, leaving pc there, if it is truncated.
+    bool decodeAt(DecodedInstruction& instr) {
+        if (pc + kMaxInstructionLength <= code.size()) [[likely]] {
+            decodeInstruction(instr);
+            return true;
+        }
+        return decodeTail(instr);
+    }
+
+    // Fewer than kMaxInstructionLength bytes are left: decode them from a
+    // zero-padded copy, whose span still ends where the input does so that
+    // trailing prefixes stand alone.
+    bool decodeTail(DecodedInstruction& instr) {
+        std::size_t left = code.size() - pc;
+        std::array<u8, kMaxInstructionLength> padded{};
+        std::copy(code.begin() + pc, code.end(), padded.begin());
+
+        InstructionDecoder tail(std::span<const u8>(padded.data(), left), origin + pc);
+        tail.decodeInstruction(instr);
+        if (instr.length <= left) {
+            pc += instr.length;
+            return true;
+        }
+
+        cut = {origin + pc, instr.opcode, instr.length, static_cast<u8>(left)};
+        is_truncated = true;
+        return false;
+    }
+
+    // Reads the record at pc with no bounds checks; decodeAt() makes sure
+    // the bytes it can reach exist.
+    void decodeInstruction(DecodedInstruction& instr) {
+        std::size_t start = pc;
+        instr = {};
+        instr.offset = origin + pc;
+
+        // Prefixes are folded into the following instruction as long as they
+        // appear once each in lock, rep, segment order; anything else starts a new record.
+        u8 last_group = 0;
+        while (pc < code.size()) {
+            u8 prefix = getPrefix(code[pc]);
+            if (!prefix) break;
+
+            u8 group = (prefix == Prefix::Lock) ? 1 : (prefix == Prefix::Segment) ? 3 : 2;
+            if (group <= last_group) break;
+            last_group = group;
+
+            instr.prefixes |= prefix;
+            INSTRUMENT_ONLY(Instrumentation::local().prefixes[std::countr_zero(prefix)]++);
+            if (prefix == Prefix::Segment) {
+                instr.segment = getSegReg((code[pc] >> 3) & 3);
+            }
+            pc++;
+        }
+
+        if (instr.prefixes && (pc == code.size() || getPrefix(code[pc]))) {
+            instr.flags |= InstructionFlags::PrefixOnly;
+            INSTRUMENT_ONLY(Instrumentation::local().prefix_only_records++);
+        } else {
+            u8 opcode = code[pc];
+            instr.opcode = opcode;
+            INSTRUMENT_ONLY(Instrumentation::local().opcodes[opcode]++);
+            INSTRUMENT_ONLY(Instrumentation::Sample sample(Instrumentation::local().handlers[static_cast<u8>(kOpcodeTable[opcode].handler)]));
+            dispatch(opcode, kOpcodeTable[opcode], instr);
+        }
+
+        instr.length = static_cast<u8>(pc - start);
+    }
+
+    static const std::array<DecodedInstruction, 256>& getOneByteTemplates() {
+        static std::array<DecodedInstruction, 256> templates = []() {
+            std::array<DecodedInstruction, 256> t{};
+            // Building the templates is not decoding input; keep it out of the counts.
+            INSTRUMENT_ONLY(Instrumentation::Counters saved = Instrumentation::local());
+            for (int opcode = 0; opcode < 256; opcode++) {
+                if (!isOneByteOpcode(opcode)) continue;
+
+                const u8 byte = static_cast<u8>(opcode);
+                InstructionDecoder decoder(std::span<const u8>(&byte, 1));
+                decoder.decodeAt(t[opcode]);
+            }
+            INSTRUMENT_ONLY(Instrumentation::local() = saved);
+            return t;
+        }();
+
+        return templates;
+    }
+
+    static u8 getPrefix(u8 byte) {
+        switch (byte) {
+            case 0xF0: return Prefix::Lock;
+            case 0xF2: return Prefix::Repne;
+            case 0xF3: return Prefix::Rep;
+            case 0x26: case 0x2E: case 0x36: case 0x3E: return Prefix::Segment;
+            default: return 0;
+        }
+    }
+
+    // A switch over the handler kinds compiles to one jump table and lets every
+    // handler inline into the decode loop.
+    void dispatch(u8 opcode, const OpcodeEntry& entry, DecodedInstruction& instr) {
+        switch (entry.handler) {
+            case Handler::Unknown: return unknownOpcode(opcode, entry.operation, instr);
+            case Handler::XchgRegMem: return decodeXchgRegMem(opcode, entry.operation, instr);
+            case Handler::RegMem: return decodeRegMem(opcode, entry.operation, instr);
+            case Handler::Rets: return decodeRets(opcode, entry.operation, instr);
+            case Handler::Loads: return decodeLoads(opcode, entry.operation, instr);
+            case Handler::RegSegReg: return decodeRegSegReg(opcode, entry.operation, instr);
+            case Handler::MovAccMem: return decodeMovAccMem(opcode, entry.operation, instr);
+            case Handler::XchgAccMem: return decodeXchgAccMem(opcode, entry.operation, instr);
+            case Handler::AccMem: return decodeAccMem(opcode, entry.operation, instr);
+            case Handler::StrOps: return decodeStrOps(opcode, entry.operation, instr);
+            case Handler::IncDec: return decodeIncDec(opcode, entry.operation, instr);
+            case Handler::SegRegPushPop: return decodeSegRegPushPop(opcode, entry.operation, instr);
+            case Handler::PushPop: return decodePushPop(opcode, entry.operation, instr);
+            case Handler::ConJmp: return decodeConJmp(opcode, entry.operation, instr);
+            case Handler::ImmRegMem: return decodeImmRegMem(opcode, entry.operation, instr);
+            case Handler::InOut: return decodeInOut(opcode, entry.operation, instr);
+            case Handler::ControlTransfer: return decodeControlTransfer(opcode, entry.operation, instr);
+            case Handler::Grp3: return decodeGrp3(opcode, entry.operation, instr);
+            case Handler::Grp5: return decodeGrp5(opcode, entry.operation, instr);
+            case Handler::RegMem16: return decodeRegMem16(opcode, entry.operation, instr);
+            case Handler::ImmToReg: return decodeImmToReg(opcode, entry.operation, instr);
+            case Handler::ImmToMem: return decodeImmToMem(opcode, entry.operation, instr);
+            case Handler::Int: return decodeInt(opcode, entry.operation, instr);
+            case Handler::ShtRot: return decodeShtRot(opcode, entry.operation, instr);
+            case Handler::ESC: return decodeESC(opcode, entry.operation, instr);
+            case Handler::Loop: return decodeLoop(opcode, entry.operation, instr);
+            case Handler::NullaryInstructionTwoBytes: return decodeNullaryInstructionTwoBytes(opcode, entry.operation, instr);
+            case Handler::NullaryInstruction: return decodeNullaryInstruction(opcode, entry.operation, instr);
+        }
+    }
+
+    void unknownOpcode(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        INSTRUMENT_ONLY(Instrumentation::local().unknown_opcodes++);
+        instr.operation = operation;
+        pc++;
+    }
+
+    void decodeXchgRegMem(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 w = opcode & 1;
+
+        auto [mod, reg, rm] = readModRM(instr);
+
+        instr.operation = operation;
+        setWide(instr, w);
+        instr.operands[0] = getRM(mod, rm, instr);
+        instr.operands[1] = registerOperand(getRegister(reg, w));
+    }
+
+    void decodeRegMem(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 d = (opcode >> 1) & 1;
+        u8 w = opcode & 1;
+
+        auto [mod, reg, rm] = readModRM(instr);
+
+        instr.operation = operation;
+        setWide(instr, w);
+        instr.operands[d ? 0 : 1] = registerOperand(getRegister(reg, w));
+        instr.operands[d ? 1 : 0] = getRM(mod, rm, instr);
+    }
+
+    void decodeRets(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 has_imm = !(opcode & 1);
+
+        pc++;
+
+        instr.operation = operation;
+        if (has_imm) {
+            instr.immediate = readU16();
+            instr.operands[0] = {OperandKind::SignedImmediate, 2};
+        }
+    }
+
+    void decodeLoads(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 w = 1;
+
+        auto [mod, reg, rm] = readModRM(instr);
+
+        instr.operation = operation;
+        setWide(instr, w);
+        instr.operands[0] = registerOperand(getRegister(reg, w));
+        instr.operands[1] = getRM(mod, rm, instr);
+    }
+
+    void decodeRegSegReg(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 is_to_segReg = (opcode >> 1) & 1;
+
+        auto [mod, reg, rm] = readModRM(instr);
+        u8 sr = reg & 3;
+
+        instr.operation = operation;
+        setWide(instr, 1);
+        instr.operands[is_to_segReg ? 0 : 1] = registerOperand(getSegReg(sr));
+        instr.operands[is_to_segReg ? 1 : 0] = getRM(mod, rm, instr);
+    }
+
+    void decodeMovAccMem(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 w = opcode & 1;
+        u8 is_to_mem = (opcode >> 1) & 1;
+
+        pc++;
+
+        instr.operation = operation;
+        setWide(instr, w);
+        instr.displacement = static_cast<i16>(readU16());
+        instr.operands[is_to_mem ? 0 : 1] = {OperandKind::Memory, static_cast<u8>(EffectiveAddress::Direct)};
+        instr.operands[is_to_mem ? 1 : 0] = registerOperand(getRegister(0, w));
+    }
+
+    void decodeXchgAccMem(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 reg = opcode & 7;
+
+        pc++;
+
+        instr.operation = operation;
+        setWide(instr, 1);
+        instr.operands[0] = registerOperand(Register::Ax);
+        instr.operands[1] = registerOperand(getRegister(reg, 1));
+    }
+
+    void decodeAccMem(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 w = opcode & 1;
+
+        pc++;
+
+        instr.operation = operation;
+        setWide(instr, w);
+        instr.immediate = (w) ? readU16() : readU8();
+        instr.operands[0] = registerOperand(getRegister(0, w));
+        instr.operands[1] = {OperandKind::SignedImmediate, static_cast<u8>(w ? 2 : 1)};
+    }
+
+    void decodeStrOps(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 w = opcode & 1;
+        u8 reg = (opcode - 0xA4) >> 1;
+
+        pc++;
+
+        instr.operation = kStrOpsOperations[reg];
+        setWide(instr, w);
+    }
+
+    void decodeIncDec(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 is_dec = (opcode >> 3) & 1;
+        u8 reg = opcode & 7;
+
+        pc++;
+
+        instr.operation = (is_dec) ? Operation::Dec : Operation::Inc;
+        setWide(instr, 1);
+        instr.operands[0] = registerOperand(getRegister(reg, 1));
+    }
+
+    void decodeSegRegPushPop(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 is_pop = opcode & 1;
+        u8 sr = (opcode >> 3) & 3;
+
+        pc++;
+
+        instr.operation = (is_pop) ? Operation::Pop : Operation::Push;
+        setWide(instr, 1);
+        instr.operands[0] = registerOperand(getSegReg(sr));
+    }
+
+    void decodePushPop(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 is_pop = (opcode >> 3) & 1;
+        u8 reg = opcode & 7;
+
+        pc++;
+
+        instr.operation = (is_pop) ? Operation::Pop : Operation::Push;
+        setWide(instr, 1);
+        instr.operands[0] = registerOperand(getRegister(reg, 1));
+    }
+
+    void decodeConJmp(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        pc++;
+
+        instr.operation = static_cast<Operation>(static_cast<u8>(Operation::Jo) + (opcode - 0x70));
+        instr.displacement = static_cast<i8>(readU8());
+        instr.operands[0] = {OperandKind::Relative, 1};
+    }
+
+    void decodeImmRegMem(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 w = opcode & 1;
+        u8 s = (opcode >> 1) & 1;
+
+        auto [mod, reg, rm] = readModRM(instr);
+
+        instr.operation = kImmRegMemOperations[reg];
+        setWide(instr, w);
+        instr.flags |= InstructionFlags::SizedMemory;
+        instr.operands[0] = getRM(mod, rm, instr); // getRM first so the data follows the displacement
+
+        if (w && !s) {
+            instr.immediate = readU16();
+            instr.operands[1] = {OperandKind::Immediate, 2};
+        } else {
+            u8 data = readU8();
+            instr.immediate = (w) ? static_cast<u16>(static_cast<i8>(data)) : data;
+            instr.operands[1] = {OperandKind::Immediate, 1};
+        }
+    }
+
+    void decodeInOut(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 is_out = (opcode >> 1) & 1;
+        u8 is_dx = (opcode >> 3) & 1;
+        u8 w = opcode & 1;
+
+        pc++;
+
+        instr.operation = (is_out) ? Operation::Out : Operation::In;
+        setWide(instr, w);
+
+        Operand port = registerOperand(Register::Dx);
+        if (!is_dx) {
+            instr.immediate = readU8();
+            port = {OperandKind::Immediate, 1};
+        }
+
+        instr.operands[is_out ? 0 : 1] = port;
+        instr.operands[is_out ? 1 : 0] = registerOperand(getRegister(0, w));
+    }
+
+    void decodeControlTransfer(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        pc++;
+
+        instr.operation = operation;
+        if (opcode == 0x9A || opcode == 0xEA) {
+            instr.displacement = static_cast<i16>(readU16());
+            instr.immediate = readU16();
+            instr.operands[0] = {OperandKind::Far, 0};
+        } else if (opcode == 0xE8 || opcode == 0xE9) {
+            instr.displacement = static_cast<i16>(readU16());
+            instr.operands[0] = {OperandKind::Relative, 2};
+        } else {
+            instr.displacement = static_cast<i8>(readU8());
+            instr.operands[0] = {OperandKind::Relative, 1};
+        }
+    }
+
+    void decodeGrp3(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 w = opcode & 1;
+
+        auto [mod, reg, rm] = readModRM(instr);
+
+        instr.operation = kGrp3Operations[reg];
+        setWide(instr, w);
+        instr.flags |= InstructionFlags::SizedMemory;
+        instr.operands[0] = getRM(mod, rm, instr);
+
+        if (reg == 0) {
+            instr.immediate = (w) ? readU16() : readU8();
+            instr.operands[1] = {OperandKind::Immediate, static_cast<u8>(w ? 2 : 1)};
+        }
+    }
+
+    void decodeGrp5(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 reg = (code.data()[pc + 1] >> 3) & 7;
+
+        decodeRegMem16(opcode, kGrp5Operations[reg], instr);
+    }
+
+    void decodeRegMem16(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 w = opcode & 1;
+
+        auto [mod, reg, rm] = readModRM(instr);
+
+        instr.operation = operation;
+        setWide(instr, w);
+        // Branch targets need no size; 8F has pop whatever its reg field holds.
+        if (!(Operation::Call <= operation && operation <= Operation::JmpFar)) {
+            instr.flags |= InstructionFlags::SizedMemory;
+        }
+        instr.operands[0] = getRM(mod, rm, instr);
+    }
+
+    void decodeImmToReg(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 w = (opcode >> 3) & 1;
+        u8 reg = opcode & 7;
+
+        pc++;
+
+        instr.operation = operation;
+        setWide(instr, w);
+        instr.immediate = (w) ? readU16() : readU8();
+        instr.operands[0] = registerOperand(getRegister(reg, w));
+        instr.operands[1] = {OperandKind::SignedImmediate, static_cast<u8>(w ? 2 : 1)};
+    }
+
+    void decodeImmToMem(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 w = opcode & 1;
+
+        auto [mod, reg, rm] = readModRM(instr);
+
+        instr.operation = operation;
+        setWide(instr, w);
+        instr.flags |= InstructionFlags::SizedImmediate;
+        instr.operands[0] = getRM(mod, rm, instr);
+        instr.immediate = (w) ? readU16() : readU8();
+        instr.operands[1] = {OperandKind::Immediate, static_cast<u8>(w ? 2 : 1)};
+    }
+
+    void decodeInt(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        pc++;
+
+        instr.operation = kIntOperations[opcode - 0xCC];
+        if (opcode == 0xCD) {
+            instr.immediate = readU8();
+            instr.operands[0] = {OperandKind::Immediate, 1};
+        }
+    }
+
+    void decodeShtRot(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        u8 w = opcode & 1;
+        u8 count = (opcode >> 1) & 1;
+
+        auto [mod, reg, rm] = readModRM(instr);
+
+        instr.operation = kShtRotOperations[reg];
+        setWide(instr, w);
+        instr.flags |= InstructionFlags::SizedMemory;
+        instr.operands[0] = getRM(mod, rm, instr);
+
+        if (count) {
+            instr.operands[1] = registerOperand(Register::Cl);
+        } else {
+            instr.immediate = 1;
+            instr.operands[1] = {OperandKind::Immediate, 0};
+        }
+    }
+
+    void decodeESC(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        auto [mod, reg, rm] = readModRM(instr);
+
+        instr.operation = operation;
+        setWide(instr, 1);
+        instr.immediate = ((opcode & 7) << 3) | reg;
+        instr.operands[0] = {OperandKind::Immediate, 0};
+        instr.operands[1] = getRM(mod, rm, instr);
+    }
+
+    void decodeLoop(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        pc++;
+
+        instr.operation = kLoopOperations[opcode - 0xE0];
+        instr.displacement = static_cast<i8>(readU8());
+        instr.operands[0] = {OperandKind::Relative, 1};
+    }
+
+    // aam/aad carry their base in a second byte, kept in immediate.
+    void decodeNullaryInstructionTwoBytes(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        pc++;
+
+        instr.operation = operation;
+        instr.immediate = readU8();
+    }
+
+    void decodeNullaryInstruction(u8 opcode, Operation operation, DecodedInstruction& instr) {
+        instr.operation = operation;
+        pc++;
+    }
+
+    // code.data() rather than code[]: in the padded tail reads go past the span.
+    ModRM readModRM(DecodedInstruction& instr) {
+        u8 modrm = code.data()[pc + 1];
+        pc += 2;
+        INSTRUMENT_ONLY(Instrumentation::local().modrm_forms[(modrm >> 6) * 8 + (modrm & 7)]++);
+
+        instr.modrm = modrm;
+        instr.flags |= InstructionFlags::HasModRM;
+
+        return {static_cast<u8>((modrm >> 6) & 3), static_cast<u8>((modrm >> 3) & 7), static_cast<u8>(modrm & 7)};
+    }
+
+    Operand getRM(u8 mod, u8 rm, DecodedInstruction& instr) {
+        if (mod == 3) {
+            return registerOperand(getRegister(rm, instr.flags & InstructionFlags::Wide));
+        }
+
+        if (rm == 6 && mod == 0) {
+            instr.displacement = static_cast<i16>(readU16());
+            return {OperandKind::Memory, static_cast<u8>(EffectiveAddress::Direct)};
+        }
+
+        if (mod == 1) {
+            instr.displacement = static_cast<i8>(readU8());
+        } else if (mod == 2) {
+            instr.displacement = static_cast<i16>(readU16());
+        }
+
+        return {OperandKind::Memory, rm};
+    }
+
+    static Operand registerOperand(Register reg) {
+        return {OperandKind::Register, static_cast<u8>(reg)};
+    }
+
+    static void setWide(DecodedInstruction& instr, u8 w) {
+        if (w) instr.flags |= InstructionFlags::Wide;
+    }
+
+    u8 readU8() {
+        return code.data()[pc++];
+    }
+
+    u16 readU16() {
+        u16 value = (code.data()[pc + 1] << 8) | code.data()[pc];
+        pc += 2;
+        return value;
+    }
+};
+
+// For callers that treat a truncated instruction as an error.
+inline std::runtime_error truncatedInstruction(const Truncation& truncation) {
+    return std::runtime_error("[ERROR] Truncated instruction at position " + std::to_string(truncation.offset)
+                              + ": only " + std::to_string(truncation.available) + " of "
+                              + std::to_string(truncation.needed) + " bytes present.");
+}
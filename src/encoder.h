@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <span>
+
+#include "instruction.h"
+#include "opcode_table.h"
+
+// Assembles a decoded instruction back into machine code, from the same
+// opcode and group tables the decoder reads. The recorded opcode only picks
+// the handler; the rest is chosen from the operands as they are written, the
+// way NASM chooses it: reg, r/m operands go in the r/m, reg form unless the
+// source is memory, an immediate that fits a signed byte is sign-extended
+// (83, never 82), and displacements take the shortest encoding that holds
+// them. A record that came from such an encoding encodes to its own bytes;
+// one whose text misstates its operands encodes to another instruction.
+class InstructionEncoder {
+public:
+    using Bytes = std::array<u8, kMaxInstructionLength>;
+
+    // Writes the encoding of `instr` to `out` and returns its length, or 0
+    // when the record names an operation its form cannot encode.
+    static std::size_t encode(const DecodedInstruction& instr, Bytes& out) {
+        Writer writer{out};
+        if (!encodeInto(instr, writer)) return 0;
+        return writer.length;
+    }
+
+private:
+    struct Writer {
+        Bytes& out;
+        std::size_t length = 0;
+
+        void put(u8 byte) { out[length++] = byte; }
+
+        void put16(u16 value) {
+            put(static_cast<u8>(value));
+            put(static_cast<u8>(value >> 8));
+        }
+
+        void putData(u16 value, bool wide) {
+            if (wide) {
+                put16(value);
+            } else {
+                put(static_cast<u8>(value));
+            }
+        }
+    };
+
+    static bool encodeInto(const DecodedInstruction& instr, Writer& out) {
+        if (instr.prefixes & Prefix::Lock) out.put(0xF0);
+        if (instr.prefixes & Prefix::Repne) out.put(0xF2);
+        if (instr.prefixes & Prefix::Rep) out.put(0xF3);
+        if (instr.prefixes & Prefix::Segment) out.put(static_cast<u8>(0x26 | segmentIndex(instr.segment) << 3));
+        if (instr.flags & InstructionFlags::PrefixOnly) return true;
+
+        const Operand* operands = instr.operands;
+        const Operation operation = instr.operation;
+        const u8 w = (instr.flags & InstructionFlags::Wide) ? 1 : 0;
+        const u8 opcode = instr.opcode;
+
+        switch (kOpcodeTable[opcode].handler) {
+            case Handler::Unknown:
+            case Handler::NullaryInstruction:
+                out.put(opcode);
+                return true;
+
+            case Handler::NullaryInstructionTwoBytes:
+                out.put(opcode);
+                out.put(static_cast<u8>(instr.immediate));
+                return true;
+
+            case Handler::XchgRegMem:
+                out.put(0x86 | w);
+                return putModRM(out, registerIndex(operands[1]), operands[0], instr);
+
+            case Handler::RegMem: {
+                // test has no reg, r/m form; its decoder always puts the register second.
+                u8 d = operation != Operation::Test && operands[1].kind == OperandKind::Memory;
+                int base = (operation == Operation::Test) ? 0x84 : (operation == Operation::Mov) ? 0x88 : aluOpcode(operation, 0);
+                if (base < 0) return false;
+                out.put(static_cast<u8>(base | d << 1 | w));
+                return putModRM(out, registerIndex(operands[d ? 0 : 1]), operands[d ? 1 : 0], instr);
+            }
+
+            case Handler::Rets: {
+                bool has_imm = operands[0].kind != OperandKind::None;
+                out.put(static_cast<u8>((operation == Operation::Retf ? 0xCA : 0xC2) | !has_imm));
+                if (has_imm) out.put16(instr.immediate);
+                return true;
+            }
+
+            case Handler::Loads:
+                out.put(operation == Operation::Lea ? 0x8D : operation == Operation::Les ? 0xC4 : 0xC5);
+                return putModRM(out, registerIndex(operands[0]), operands[1], instr);
+
+            case Handler::RegSegReg: {
+                u8 to_segment = isSegmentRegister(operands[0]);
+                out.put(static_cast<u8>(0x8C | to_segment << 1));
+                return putModRM(out, registerIndex(operands[to_segment ? 0 : 1]), operands[to_segment ? 1 : 0], instr);
+            }
+
+            case Handler::MovAccMem: {
+                u8 to_memory = operands[0].kind == OperandKind::Memory;
+                out.put(static_cast<u8>(0xA0 | to_memory << 1 | w));
+                out.put16(static_cast<u16>(instr.displacement));
+                return true;
+            }
+
+            case Handler::XchgAccMem:
+                out.put(0x90 | registerIndex(operands[1]));
+                return true;
+
+            case Handler::AccMem: {
+                int base = (operation == Operation::Test) ? 0xA8 : aluOpcode(operation, 4);
+                if (base < 0) return false;
+                out.put(static_cast<u8>(base | w));
+                out.putData(immediate(instr), w);
+                return true;
+            }
+
+            case Handler::StrOps: {
+                int index = indexOf(kStrOpsOperations, operation);
+                if (index < 0) return false;
+                out.put(static_cast<u8>(0xA4 + 2 * index + w));
+                return true;
+            }
+
+            case Handler::IncDec:
+                out.put(static_cast<u8>(0x40 | (operation == Operation::Dec) << 3 | registerIndex(operands[0])));
+                return true;
+
+            case Handler::SegRegPushPop:
+                out.put(static_cast<u8>(0x06 | registerIndex(operands[0]) << 3 | (operation == Operation::Pop)));
+                return true;
+
+            case Handler::PushPop:
+                out.put(static_cast<u8>(0x50 | (operation == Operation::Pop) << 3 | registerIndex(operands[0])));
+                return true;
+
+            case Handler::ConJmp:
+                if (operation < Operation::Jo || operation > Operation::Jnle) return false;
+                out.put(static_cast<u8>(0x70 + (static_cast<u8>(operation) - static_cast<u8>(Operation::Jo))));
+                out.put(static_cast<u8>(instr.displacement));
+                return true;
+
+            case Handler::ImmRegMem: {
+                int index = aluIndex(operation);
+                if (index < 0) return false;
+                u16 value = immediate(instr);
+                u8 s = w && static_cast<i16>(value) >= -128 && static_cast<i16>(value) <= 127;
+                out.put(static_cast<u8>(0x80 | s << 1 | w));
+                if (!putModRM(out, index, operands[0], instr)) return false;
+                out.putData(value, w && !s);
+                return true;
+            }
+
+            case Handler::InOut: {
+                bool is_out = operation == Operation::Out;
+                const Operand& port = operands[is_out ? 0 : 1];
+                bool is_dx = port.kind == OperandKind::Register;
+                out.put(static_cast<u8>((is_dx ? 0xEC : 0xE4) | is_out << 1 | w));
+                if (!is_dx) out.put(static_cast<u8>(instr.immediate));
+                return true;
+            }
+
+            case Handler::ControlTransfer: {
+                bool call = operation == Operation::Call;
+                if (operands[0].kind == OperandKind::Far) {
+                    out.put(call ? 0x9A : 0xEA);
+                    out.put16(static_cast<u16>(instr.displacement));
+                    out.put16(instr.immediate);
+                } else if (operands[0].value == 2) {
+                    out.put(call ? 0xE8 : 0xE9);
+                    out.put16(static_cast<u16>(instr.displacement));
+                } else {
+                    if (call) return false;
+                    out.put(0xEB);
+                    out.put(static_cast<u8>(instr.displacement));
+                }
+                return true;
+            }
+
+            case Handler::Grp3: {
+                int index = indexOf(kGrp3Operations, operation);
+                if (index < 0) return false;
+                out.put(0xF6 | w);
+                if (!putModRM(out, index, operands[0], instr)) return false;
+                if (operands[1].kind == OperandKind::Immediate) out.putData(immediate(instr), w);
+                return true;
+            }
+
+            case Handler::Grp5: {
+                int index = indexOf(kGrp5Operations, operation);
+                if (index < 0) return false;
+                out.put(0xFE | w);
+                return putModRM(out, index, operands[0], instr);
+            }
+
+            case Handler::RegMem16:
+                out.put(0x8F);
+                return putModRM(out, 0, operands[0], instr);
+
+            case Handler::ImmToReg:
+                out.put(static_cast<u8>(0xB0 | w << 3 | registerIndex(operands[0])));
+                out.putData(immediate(instr), w);
+                return true;
+
+            case Handler::ImmToMem:
+                out.put(0xC6 | w);
+                if (!putModRM(out, 0, operands[0], instr)) return false;
+                out.putData(immediate(instr), w);
+                return true;
+
+            case Handler::Int: {
+                int index = indexOf(kIntOperations, operation);
+                if (index < 0) return false;
+                out.put(static_cast<u8>(0xCC + index));
+                if (operation == Operation::Int) out.put(static_cast<u8>(instr.immediate));
+                return true;
+            }
+
+            case Handler::ShtRot: {
+                int index = indexOf(kShtRotOperations, operation);
+                if (index < 0) return false;
+                u8 by_cl = operands[1].kind == OperandKind::Register;
+                out.put(static_cast<u8>(0xD0 | by_cl << 1 | w));
+                return putModRM(out, index, operands[0], instr);
+            }
+
+            case Handler::ESC:
+                out.put(static_cast<u8>(0xD8 | ((instr.immediate >> 3) & 7)));
+                return putModRM(out, instr.immediate & 7, operands[1], instr);
+
+            case Handler::Loop: {
+                int index = indexOf(kLoopOperations, operation);
+                if (index < 0) return false;
+                out.put(static_cast<u8>(0xE0 + index));
+                out.put(static_cast<u8>(instr.displacement));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // ModRM byte and displacement for `rm` with `reg` in the middle field.
+    static bool putModRM(Writer& out, int reg, const Operand& rm, const DecodedInstruction& instr) {
+        if (rm.kind == OperandKind::Register) {
+            out.put(static_cast<u8>(0xC0 | reg << 3 | registerIndex(rm)));
+            return true;
+        }
+        if (rm.kind != OperandKind::Memory) return false;
+
+        if (rm.value == static_cast<u8>(EffectiveAddress::Direct)) {
+            out.put(static_cast<u8>(0x06 | reg << 3));
+            out.put16(static_cast<u16>(instr.displacement));
+            return true;
+        }
+
+        // [bp] has no mod 0 form; it takes a zero disp8.
+        int disp = instr.displacement;
+        bool bp = rm.value == static_cast<u8>(EffectiveAddress::Bp);
+        u8 mod = (disp == 0 && !bp) ? 0 : (disp >= -128 && disp <= 127) ? 1 : 2;
+
+        out.put(static_cast<u8>(mod << 6 | reg << 3 | rm.value));
+        if (mod == 1) out.put(static_cast<u8>(disp));
+        if (mod == 2) out.put16(static_cast<u16>(disp));
+        return true;
+    }
+
+    // The source immediate as the text writes it.
+    static u16 immediate(const DecodedInstruction& instr) {
+        return static_cast<u16>(getImmediateValue(instr, instr.operands[1]));
+    }
+
+    static int indexOf(std::span<const Operation> operations, Operation operation) {
+        auto it = std::find(operations.begin(), operations.end(), operation);
+        return (it == operations.end()) ? -1 : static_cast<int>(it - operations.begin());
+    }
+
+    static int aluIndex(Operation operation) {
+        return indexOf(kImmRegMemOperations, operation);
+    }
+
+    // Opcode of an arithmetic operation's form at `form` within its block of eight.
+    static int aluOpcode(Operation operation, u8 form) {
+        int index = aluIndex(operation);
+        return (index < 0) ? -1 : (index << 3 | form);
+    }
+
+    // Register number as encoded: al..bh and ax..di are 0..7, es..ds 0..3.
+    static u8 registerIndex(const Operand& operand) {
+        return isSegmentRegister(operand) ? segmentIndex(static_cast<Register>(operand.value)) : (operand.value & 7);
+    }
+
+    static bool isSegmentRegister(const Operand& operand) {
+        return operand.kind == OperandKind::Register && operand.value >= static_cast<u8>(Register::Es);
+    }
+
+    static u8 segmentIndex(Register segment) {
+        return static_cast<u8>(segment) - static_cast<u8>(Register::Es);
+    }
+};
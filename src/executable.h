@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "instruction.h"
+
+// How a file is laid out on disk. Flat files are code from their first byte.
+// A DOS .COM program is the same but loaded at offset 0x100 of its segment.
+// An MZ executable is a header and relocation table, the load module, and
+// possibly overlay data that DOS never loads.
+enum class ImageFormat : u8 {
+    Flat,
+    Com,
+    Mz,
+};
+
+// The part of a file that is decoded, and where it sits once loaded.
+struct ExecutableImage {
+    ImageFormat format = ImageFormat::Flat;
+    std::span<const u8> code;
+    std::size_t origin = 0;        // offset of code[0] in the output: 0x100 for .COM
+    std::size_t file_offset = 0;   // where code[0] is in the file
+    std::size_t entry = 0;         // entry point, an output offset
+    u16 entry_cs = 0;
+    u16 entry_ip = 0;
+    std::size_t skipped = 0;       // file bytes after the load module
+    std::vector<std::size_t> relocations;  // load-module offsets of the segment words DOS patches
+};
+
+// "flat", "com" or "exe"; nothing for anything else.
+inline std::optional<ImageFormat> parseImageFormat(std::string_view name) {
+    if (name == "flat") return ImageFormat::Flat;
+    if (name == "com") return ImageFormat::Com;
+    if (name == "exe") return ImageFormat::Mz;
+    return std::nullopt;
+}
+
+// Finds the code in `file`. Without a format it is guessed the way DOS does:
+// an MZ signature makes an executable whatever the name, then a `.com` name
+// makes a .COM program, and anything else is flat.
+inline ExecutableImage loadExecutable(std::span<const u8> file, const std::string& path, std::optional<ImageFormat> format = std::nullopt) {
+    auto word = [&file](std::size_t at) { return static_cast<u16>(file[at] | file[at + 1] << 8); };
+
+    // Fields of the MZ header, at their offsets in the file.
+    constexpr std::size_t kLastPageBytes = 0x02, kPages = 0x04, kRelocationCount = 0x06, kHeaderParagraphs = 0x08;
+    constexpr std::size_t kInitialIp = 0x14, kInitialCs = 0x16, kRelocationTable = 0x18, kHeaderSize = 0x1C;
+
+    bool signed_mz = file.size() >= kHeaderSize && ((file[0] == 'M' && file[1] == 'Z') || (file[0] == 'Z' && file[1] == 'M'));
+    if (!format) {
+        std::string_view extension = std::string_view(path).substr(path.size() - std::min<std::size_t>(path.size(), 4));
+        bool com = std::equal(extension.begin(), extension.end(), ".com", ".com" + 4,
+                              [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == b; });
+        format = signed_mz ? ImageFormat::Mz : com ? ImageFormat::Com : ImageFormat::Flat;
+    }
+
+    ExecutableImage image;
+    image.format = *format;
+    image.code = file;
+
+    if (image.format == ImageFormat::Com) {
+        // The program and its 256-byte PSP share one 64 KB segment.
+        if (file.size() > 0x10000 - 0x100) throw std::runtime_error("[ERROR] Too large for a .COM program: " + path);
+        image.origin = 0x100;
+        image.entry = 0x100;
+        image.entry_ip = 0x100;
+        return image;
+    }
+    if (image.format == ImageFormat::Flat) return image;
+
+    if (!signed_mz) throw std::runtime_error("[ERROR] Not an MZ executable: " + path);
+
+    // The load module ends where the page count says; a partial last page
+    // holds only kLastPageBytes bytes, and 0 there means a full page.
+    std::size_t header = std::size_t(word(kHeaderParagraphs)) * 16;
+    std::size_t last_page = word(kLastPageBytes) & 0x1FF;
+    std::size_t pages = word(kPages);
+    std::size_t end = pages * 512;
+    if (pages && last_page) end -= 512 - last_page;
+    end = std::min(end, file.size());
+    if (header < kHeaderSize || header > end) throw std::runtime_error("[ERROR] Invalid MZ header size: " + path);
+
+    std::size_t table = word(kRelocationTable);
+    std::size_t count = word(kRelocationCount);
+    if (table + 4 * count > header) throw std::runtime_error("[ERROR] MZ relocation table runs past the header: " + path);
+
+    image.code = file.subspan(header, end - header);
+    image.file_offset = header;
+    image.skipped = file.size() - end;
+    image.entry_ip = word(kInitialIp);
+    image.entry_cs = word(kInitialCs);
+    image.entry = ((std::size_t(image.entry_cs) << 4) + image.entry_ip) & 0xFFFFF;
+
+    image.relocations.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        std::size_t at = table + 4 * i;
+        image.relocations.push_back(((std::size_t(word(at + 2)) << 4) + word(at)) & 0xFFFFF);
+    }
+    std::sort(image.relocations.begin(), image.relocations.end());
+    return image;
+}
@@ -0,0 +1,453 @@
+#include <iostream>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "input.h"
+#include "instruction_stream.h"
+#include "length_decoder.h"
+#include "nasm_formatter.h"
+#include "output_buffer.h"
+
+// Differential fuzz target for the decoder. Every input is decoded and checked
+// against other views of the same bytes:
+//   - the records tile the input from offset 0, each 1 to kMaxInstructionLength
+//     bytes long, and decoding only stops early at an instruction cut off by
+//     the end;
+//   - LengthDecoder finds the same boundaries, decodeOne() the same record at
+//     each of them, and a reused InstructionStream the same records;
+//   - decoding in two windows, split the way the stream reader splits, gives
+//     the same records;
+//   - InstructionEncoder, which assembles from the operands as written,
+//     turns every record back into its bytes or, where NASM would pick
+//     another encoding (a displacement or immediate written long, an ignored
+//     reg field, a redundant direction or sign bit), into bytes that format
+//     to the same text and decode to the same instruction;
+//   - no formatted line is longer than NasmFormatter::kMaxLineLength.
+//
+// Built with -DLIBFUZZER only LLVMFuzzerTestOneInput is compiled, for
+// `clang++ -fsanitize=fuzzer`. Otherwise main() first runs a few fixed
+// programs on Cpu whose results a real 8086 fixes, then drives it with random inputs,
+// each ending right before an inaccessible page so that a read past the end
+// faults. When a case crashes, hangs or fails a check, its input is saved for
+// replay with `fuzz FILE...`.
+
+struct FuzzStats {
+    u64 cases = 0;
+    u64 bytes = 0;
+    u64 instructions = 0;
+    u64 truncated = 0;
+    std::array<u64, 256> non_canonical{};   // by opcode
+};
+
+static FuzzStats stats;
+
+static bool sameRecord(const DecodedInstruction& a, const DecodedInstruction& b) {
+    return a.offset == b.offset && a.displacement == b.displacement && a.immediate == b.immediate
+        && a.operation == b.operation && a.opcode == b.opcode && a.modrm == b.modrm && a.length == b.length
+        && a.prefixes == b.prefixes && a.segment == b.segment && a.flags == b.flags
+        && a.operands[0].kind == b.operands[0].kind && a.operands[0].value == b.operands[0].value
+        && a.operands[1].kind == b.operands[1].kind && a.operands[1].value == b.operands[1].value;
+}
+
+// Same operation on the same operands, however each was encoded.
+static bool sameMeaning(const DecodedInstruction& a, const DecodedInstruction& b) {
+    if (a.operation != b.operation || a.prefixes != b.prefixes || a.immediate != b.immediate) return false;
+    if ((a.flags ^ b.flags) & InstructionFlags::Wide) return false;
+    if ((a.prefixes & Prefix::Segment) && a.segment != b.segment) return false;
+
+    for (int i = 0; i < 2; i++) {
+        const Operand& x = a.operands[i];
+        const Operand& y = b.operands[i];
+        if (x.kind != y.kind) return false;
+        switch (x.kind) {
+            case OperandKind::Register:
+                if (x.value != y.value) return false;
+                break;
+            case OperandKind::Memory:
+                if (x.value != y.value || a.displacement != b.displacement) return false;
+                break;
+            case OperandKind::Relative:
+                if (getBranchTarget(a) != getBranchTarget(b)) return false;
+                break;
+            case OperandKind::Far:
+                if (a.displacement != b.displacement) return false;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+// Decodes `code` into `records`; returns false if it ended in a truncated instruction.
+static bool decodeAll(std::span<const u8> code, std::size_t origin, bool final, std::vector<DecodedInstruction>& records, std::size_t& position) {
+    InstructionDecoder decoder(code, origin, final);
+    std::array<DecodedInstruction, 64> batch;
+    std::size_t first = records.size();
+    while (std::size_t count = decoder.decode(batch.data(), batch.size())) {
+        records.insert(records.end(), batch.begin(), batch.begin() + count);
+        // A record never covers less than a byte; more records than bytes means pc stopped moving.
+        if (records.size() - first > code.size()) break;
+    }
+    position = decoder.position();
+    return !decoder.truncated();
+}
+
+static std::string_view formatRecord(const DecodedInstruction& instr, OutputBuffer& text) {
+    text.clear();
+    NasmFormatter formatter(text);
+    formatter.format(instr);
+    return text.view();
+}
+
+// Returns why `code` fails a check, or nullptr.
+static const char* checkInput(std::span<const u8> code, std::size_t& at) {
+    static std::vector<DecodedInstruction> records;
+    static std::vector<DecodedInstruction> windowed;
+    static std::vector<u8> lengths;
+    static OutputBuffer text;
+    static OutputBuffer other_text;
+    static InstructionStream stream;
+
+    at = 0;
+    records.clear();
+    std::size_t position;
+    bool complete = decodeAll(code, 0, true, records, position);
+    if (records.size() > code.size()) return "the decoder stopped advancing";
+
+    std::size_t end = 0;
+    for (const DecodedInstruction& instr : records) {
+        at = instr.offset;
+        if (instr.offset != end) return "records do not tile the input";
+        if (instr.length == 0 || instr.length > kMaxInstructionLength) return "record length out of range";
+        end += instr.length;
+    }
+    at = end;
+    if (end > code.size()) return "records run past the end of the input";
+    if (complete && end != code.size()) return "decoding stopped early without an error";
+    if (!complete && code.size() - end >= kMaxInstructionLength) return "truncation reported before the last instruction";
+
+    stats.cases++;
+    stats.bytes += code.size();
+    stats.instructions += records.size();
+    stats.truncated += !complete;
+
+    LengthDecoder length_decoder(code);
+    lengths.resize(code.size());
+    std::size_t count = 0;
+    while (std::size_t n = length_decoder.lengths(lengths.data() + count, lengths.size() - count)) count += n;
+    if (count != records.size() || length_decoder.position() != end || length_decoder.truncated() == complete) {
+        at = std::min(length_decoder.position(), end);
+        return "LengthDecoder disagrees on the boundaries";
+    }
+    for (std::size_t i = 0; i < count; i++) {
+        if (lengths[i] != records[i].length) {
+            at = records[i].offset;
+            return "LengthDecoder disagrees on a length";
+        }
+    }
+
+    for (const DecodedInstruction& instr : records) {
+        at = instr.offset;
+        if (!sameRecord(InstructionDecoder::decodeOne(code, instr.offset), instr)) return "decodeOne gives a different record";
+    }
+    if (!complete) {
+        Truncation truncation{};
+        if (InstructionDecoder::decodeOne(code, end, &truncation).length != 0) return "decodeOne decodes a truncated instruction";
+        if (truncation.offset != end || truncation.available != code.size() - end || truncation.needed <= truncation.available) {
+            return "the truncation diagnostic does not match the input";
+        }
+    }
+
+    stream.reset(code);
+    std::size_t streamed = 0;
+    for (const DecodedInstruction& instr : stream) {
+        at = instr.offset;
+        if (streamed == records.size() || !sameRecord(instr, records[streamed])) return "InstructionStream gives a different record";
+        streamed++;
+    }
+    at = stream.position();
+    if (streamed != records.size() || stream.position() != end || stream.truncated() == complete) return "InstructionStream stops elsewhere";
+
+    // A non-final window shorter than the longest instruction decodes nothing.
+    windowed.clear();
+    std::size_t split = code.size() / 2;
+    std::size_t resume = 0;
+    if (split < code.size() && !decodeAll(code.first(split), 0, false, windowed, resume)) {
+        at = resume;
+        return "a non-final window ended in a truncated instruction";
+    }
+    decodeAll(code.subspan(resume), resume, true, windowed, position);
+    if (windowed.size() != records.size()) return "windowed decoding gives a different record count";
+    for (std::size_t i = 0; i < records.size(); i++) {
+        at = records[i].offset;
+        if (!sameRecord(records[i], windowed[i])) return "windowed decoding gives a different record";
+    }
+
+    for (const DecodedInstruction& instr : records) {
+        at = instr.offset;
+        std::string_view line = formatRecord(instr, text);
+        if (line.size() > NasmFormatter::kMaxLineLength) return "formatted line longer than kMaxLineLength";
+
+        InstructionEncoder::Bytes bytes;
+        std::size_t length = InstructionEncoder::encode(instr, bytes);
+        if (!length) return "the record cannot be encoded";
+        if (length == instr.length && std::equal(bytes.begin(), bytes.begin() + length, code.begin() + instr.offset)) continue;
+
+        // Another encoding of the same instruction: it must read back as the same text.
+        DecodedInstruction again = InstructionDecoder::decodeOne(std::span<const u8>(bytes.data(), length), 0);
+        if (again.length != length) return "the encoding is not one instruction";
+        again.offset = instr.offset;
+        if (formatRecord(again, other_text) != formatRecord(instr, text)) return "the encoding decodes to different text";
+        if (!sameMeaning(again, instr)) return "the text reassembles to a different instruction";
+        stats.non_canonical[instr.opcode]++;
+    }
+    return nullptr;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    std::size_t at;
+    if (const char* failure = checkInput(std::span<const u8>(data, size), at)) {
+        std::fprintf(stderr, "[ERROR] %s at offset %zu\n", failure, at);
+        std::abort();
+    }
+    return 0;
+}
+
+#ifndef LIBFUZZER
+
+// `lodsb` under prefixes in orders the decoder splits into several records
+// (es rep, ds rep es, es ds); the CPU must still apply all of them, the last
+// segment override winning. ES:0 holds 0xAA, DS:0 0xBB and CS:0 the code.
+static const char* checkExecution() {
+    struct Program {
+        std::vector<u8> code;
+        u8 al;
+        u16 cx;
+    };
+    const Program programs[] = {
+        {{0xF3, 0x26, 0xAC}, 0xAA, 0},
+        {{0x26, 0xF3, 0xAC}, 0xAA, 0},
+        {{0x3E, 0xF3, 0x26, 0xAC}, 0xAA, 0},
+        {{0x26, 0x3E, 0xAC}, 0xBB, 1},
+        {{0xF3, 0xAC}, 0xBB, 0},
+    };
+
+    for (const Program& program : programs) {
+        Cpu cpu;
+        cpu.load(program.code, 0);
+        cpu.write8(0x10000, 0xAA);
+        cpu.write8(0x20000, 0xBB);
+        CpuState& state = cpu.state();
+        state.segs = {0x1000, 0, 0, 0x2000};
+        state.regs[1] = 1;  // cx
+
+        cpu.run(program.code.size() + 1);
+        if (!cpu.halted()) return "a prefixed lodsb did not run to the end";
+        if ((state.regs[0] & 0xFF) != program.al) return "a prefixed lodsb read through the wrong segment";
+        if (state.regs[1] != program.cx) return "a prefixed lodsb lost its rep prefix";
+    }
+    return nullptr;
+}
+
+// The case in flight, for the crash and hang reports.
+static const u8* volatile current_data = nullptr;
+static volatile std::size_t current_size = 0;
+static std::atomic<u64> progress{0};
+
+// Async-signal-safe: only open, write and close.
+static void saveInput(const char* path) {
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    if (current_data && ::write(fd, current_data, current_size) < 0) {}
+    ::close(fd);
+}
+
+static void onCrash(int signal) {
+    saveInput("fuzz-crash.bin");
+    const char message[] = "[ERROR] The decoder crashed; the input is saved in fuzz-crash.bin\n";
+    if (::write(STDERR_FILENO, message, sizeof(message) - 1) < 0) {}
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+
+// Ends the process if no case finishes within `seconds`.
+static void watchdog(unsigned seconds) {
+    u64 seen = progress.load();
+    for (;;) {
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        u64 now = progress.load();
+        if (now == seen) {
+            saveInput("fuzz-hang.bin");
+            std::fprintf(stderr, "[ERROR] A case ran for more than %u s; the input is saved in fuzz-hang.bin\n", seconds);
+            ::_exit(3);
+        }
+        seen = now;
+    }
+}
+
+// Pages for inputs of up to `capacity` bytes, followed by one that faults on access.
+class GuardedBuffer {
+public:
+    GuardedBuffer(std::size_t capacity) {
+        std::size_t page = ::sysconf(_SC_PAGESIZE);
+        size = (capacity + page - 1) / page * page + page;
+        void* map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) throw std::runtime_error("[ERROR] Cannot map the input buffer.");
+        base = static_cast<u8*>(map);
+        guard = base + size - page;
+        ::mprotect(guard, page, PROT_NONE);
+    }
+
+    ~GuardedBuffer() { ::munmap(base, size); }
+
+    // Room for `length` bytes that end at the guard page.
+    u8* place(std::size_t length) { return guard - length; }
+
+private:
+    u8* base;
+    u8* guard;
+    std::size_t size;
+};
+
+static int runCase(std::span<const u8> code, const std::string& save_as) {
+    current_size = code.size();
+    current_data = code.data();
+
+    std::size_t at;
+    const char* failure = checkInput(code, at);
+    progress++;
+    if (!failure) return 0;
+
+    saveInput(save_as.c_str());
+    std::cerr << "[ERROR] " << failure << " at offset " << at << "; the input is saved in " << save_as << std::endl;
+    return 1;
+}
+
+static void printStats(double seconds) {
+    std::printf("cases %llu, bytes %llu, instructions %llu, truncated %llu, %.1f s, %.2f M instructions/s\n",
+                (unsigned long long)stats.cases, (unsigned long long)stats.bytes, (unsigned long long)stats.instructions,
+                (unsigned long long)stats.truncated, seconds, seconds > 0 ? stats.instructions / seconds / 1e6 : 0.0);
+
+    u64 total = 0;
+    for (u64 count : stats.non_canonical) total += count;
+    if (!total) return;
+
+    // Inputs NASM would not reassemble byte for byte from the text.
+    std::printf("non-canonical encodings %llu:", (unsigned long long)total);
+    for (int opcode = 0; opcode < 256; opcode++) {
+        if (stats.non_canonical[opcode]) std::printf(" %02x:%llu", opcode, (unsigned long long)stats.non_canonical[opcode]);
+    }
+    std::printf("\n");
+}
+
+// Reads a whole decimal number; false on anything else, signs included for unsigned types.
+template<typename T>
+static bool parseValue(std::string_view text, T& value) {
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return error == std::errc() && end == text.data() + text.size();
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = 10;
+    u64 max_cases = 0;
+    std::size_t max_size = 256;
+    u64 seed = std::random_device{}();
+    unsigned hang_seconds = 5;
+    std::vector<std::string> replay;
+
+    bool usage_error = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc) {
+            usage_error = !parseValue(argv[++i], seconds) || !(seconds >= 0);
+        } else if (arg == "--cases" && i + 1 < argc) {
+            usage_error = !parseValue(argv[++i], max_cases);
+        } else if (arg == "--max-size" && i + 1 < argc) {
+            usage_error = !parseValue(argv[++i], max_size);
+            max_size = std::max<std::size_t>(max_size, 1);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            usage_error = !parseValue(argv[++i], seed);
+        } else if (arg == "--hang" && i + 1 < argc) {
+            usage_error = !parseValue(argv[++i], hang_seconds);
+            hang_seconds = std::max(hang_seconds, 1u);
+        } else if (!arg.empty() && arg[0] != '-') {
+            replay.push_back(arg);
+        } else {
+            usage_error = true;
+        }
+        if (usage_error) {
+            std::cout << "[ERROR] Usage: " << argv[0] << " [--seconds S] [--cases N] [--max-size BYTES] [--seed N] [--hang S] [FILE...]" << std::endl;
+            return 1;
+        }
+    }
+
+    for (int signal : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) std::signal(signal, onCrash);
+    std::thread(watchdog, hang_seconds).detach();
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+
+    try {
+        if (const char* failure = checkExecution()) {
+            std::cerr << "[ERROR] " << failure << std::endl;
+            return 1;
+        }
+
+        if (!replay.empty()) {
+            int failed = 0;
+            for (const std::string& path : replay) {
+                InputFile input(path);
+                std::span<const u8> bytes = input.bytes();
+                GuardedBuffer buffer(bytes.size());
+                u8* data = buffer.place(bytes.size());
+                std::copy(bytes.begin(), bytes.end(), data);
+                failed += runCase(std::span<const u8>(data, bytes.size()), path + ".failure");
+            }
+            printStats(elapsed());
+            return failed ? 1 : 0;
+        }
+
+        // Mostly uniform bytes, with prefixes more often than chance so that
+        // folding and prefix-only records get exercised.
+        constexpr u8 kPrefixes[] = {0x26, 0x2E, 0x36, 0x3E, 0xF0, 0xF2, 0xF3};
+        std::mt19937_64 rng(seed);
+        GuardedBuffer buffer(max_size);
+        std::printf("seed %llu\n", (unsigned long long)seed);
+        std::fflush(stdout);
+
+        for (u64 n = 0; max_cases ? n < max_cases : (n % 1024 != 0 || elapsed() < seconds); n++) {
+            std::size_t size = 1 + rng() % max_size;
+            u8* data = buffer.place(size);
+            for (std::size_t i = 0; i < size; i++) {
+                u64 r = rng();
+                data[i] = ((r >> 8) % 8 == 0) ? kPrefixes[(r >> 16) % std::size(kPrefixes)] : static_cast<u8>(r);
+            }
+            if (runCase(std::span<const u8>(data, size), "fuzz-failure.bin")) return 1;
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    printStats(elapsed());
+    return 0;
+}
+
+#endif
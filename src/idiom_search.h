@@ -0,0 +1,411 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "instruction.h"
+
+// One instruction of an idiom, e.g. "rep movsw", "mov ah, *" or "int 0x21".
+// An instruction needs the listed prefixes and may carry others. Without
+// operands any operands match; with them the count must agree and each
+// operand must match: `*` anything, `reg`, `mem` and `imm` any operand of
+// that kind, a register name that register, and a number an immediate with
+// that value (in the operand's width) or a branch to that offset. `*` in place
+// of the mnemonic matches any one record.
+struct InstructionPattern {
+    enum class Match : u8 { Any, AnyRegister, AnyMemory, AnyImmediate, Register, Value };
+
+    struct OperandPattern {
+        Match match = Match::Any;
+        Register reg = Register::Al;
+        int value = 0;
+
+        bool operator==(const OperandPattern&) const = default;
+    };
+
+    static constexpr u8 kAnyOperands = 0xFF;
+
+    Operation operation = Operation::Count;   // Count: any record
+    u8 prefixes = 0;
+    u8 width = 0;                              // string operations: 1 or 2 bytes, 0 for either
+    u8 operand_count = kAnyOperands;
+    OperandPattern operands[2] = {};
+
+    bool operator==(const InstructionPattern&) const = default;
+
+    bool matches(const DecodedInstruction& instr) const {
+        if (operation != Operation::Count && instr.operation != operation) return false;
+        if ((instr.prefixes & prefixes) != prefixes) return false;
+        if (width && ((instr.flags & InstructionFlags::Wide) ? 2 : 1) != width) return false;
+        if (operand_count == kAnyOperands) return true;
+
+        u8 count = (instr.operands[0].kind != OperandKind::None) + (instr.operands[1].kind != OperandKind::None);
+        if (count != operand_count) return false;
+        for (u8 i = 0; i < count; i++) {
+            if (!matches(operands[i], instr, instr.operands[i])) return false;
+        }
+        return true;
+    }
+
+private:
+    static bool matches(const OperandPattern& pattern, const DecodedInstruction& instr, Operand operand) {
+        switch (pattern.match) {
+            case Match::Any:
+                return true;
+            case Match::AnyRegister:
+                return operand.kind == OperandKind::Register;
+            case Match::AnyMemory:
+                return operand.kind == OperandKind::Memory;
+            case Match::AnyImmediate:
+                return operand.kind == OperandKind::Immediate || operand.kind == OperandKind::SignedImmediate;
+            case Match::Register:
+                return operand.kind == OperandKind::Register && operand.value == static_cast<u8>(pattern.reg);
+            case Match::Value:
+                if (operand.kind == OperandKind::Immediate || operand.kind == OperandKind::SignedImmediate) {
+                    u32 mask = (operand.value == 1) ? 0xFF : 0xFFFF;
+                    return ((instr.immediate ^ static_cast<u32>(pattern.value)) & mask) == 0;
+                }
+                if (operand.kind == OperandKind::Relative) {
+                    return static_cast<u16>(getBranchTarget(instr)) == static_cast<u16>(pattern.value);
+                }
+                return false;
+        }
+        return false;
+    }
+};
+
+// A set of idioms, each a sequence of instruction patterns separated by `;`,
+// compiled into a trie whose edges are instruction patterns. Idioms with
+// common first instructions share their nodes. The edges out of a node are
+// sorted by a key of the operation, the first operand's register and the low
+// byte of the immediate or branch target, each left open where the pattern
+// has a wildcard, so a record finds the few edges it can take by binary
+// search instead of testing every pattern. add() every idiom, then finish().
+class IdiomSet {
+public:
+    static constexpr std::size_t kMaxLength = 64;
+
+    IdiomSet() : nodes(1) {}
+
+    // Throws for text that is not a valid idiom.
+    void add(std::string_view text) {
+        std::vector<InstructionPattern> steps;
+        std::size_t start = 0;
+        while (start <= text.size()) {
+            std::size_t end = std::min(text.find(';', start), text.size());
+            steps.push_back(parseInstruction(text.substr(start, end - start), text));
+            start = end + 1;
+        }
+        if (steps.size() > kMaxLength) throw std::runtime_error("[ERROR] Idiom longer than 64 instructions: " + std::string(text));
+
+        u32 node = 0;
+        for (const InstructionPattern& step : steps) {
+            auto& children = pending[node];
+            auto it = std::find_if(children.begin(), children.end(), [&](u32 child) { return nodes[child].pattern == step; });
+            if (it != children.end()) {
+                node = *it;
+                continue;
+            }
+
+            u32 child = static_cast<u32>(nodes.size());
+            nodes.push_back({step, static_cast<u8>(nodes[node].depth + 1)});
+            pending.emplace_back();
+            pending[node].push_back(child);
+            node = child;
+        }
+
+        nodes[node].idioms.push_back(static_cast<u32>(texts.size()));
+        texts.emplace_back(text);
+        longest = std::max(longest, steps.size());
+    }
+
+    // Lays the edges out for matching; no add() may follow.
+    void finish() {
+        for (std::size_t i = 0; i < nodes.size(); i++) {
+            auto& children = pending[i];
+            std::stable_sort(children.begin(), children.end(), [this](u32 a, u32 b) { return edgeKey(a) < edgeKey(b); });
+            nodes[i].first_edge = static_cast<u32>(edges.size());
+            for (u32 child : children) {
+                edges.push_back(child);
+                edge_keys.push_back(edgeKey(child));
+            }
+            nodes[i].last_edge = static_cast<u32>(edges.size());
+        }
+        pending.clear();
+
+        // The root is left for every record, so its edges for each operation are found by table.
+        for (u32 op = 0; op < root_edges.size(); op++) {
+            auto begin = edge_keys.begin() + nodes[0].first_edge;
+            auto end = edge_keys.begin() + nodes[0].last_edge;
+            root_edges[op] = {static_cast<u32>(std::lower_bound(begin, end, makeKey(op, 0, 0)) - edge_keys.begin()),
+                              static_cast<u32>(std::lower_bound(begin, end, makeKey(op + 1, 0, 0)) - edge_keys.begin())};
+        }
+    }
+
+    std::size_t size() const { return texts.size(); }
+
+    std::string_view text(std::size_t idiom) const { return texts[idiom]; }
+
+    // Instructions in the longest idiom.
+    std::size_t longestIdiom() const { return longest; }
+
+private:
+    friend class IdiomMatcher;
+
+    struct Node {
+        InstructionPattern pattern;
+        u8 depth = 0;
+        u32 first_edge = 0;
+        u32 last_edge = 0;
+        std::vector<u32> idioms;   // that end here
+    };
+
+    // What a record offers to the edge keys.
+    struct RecordKey {
+        u32 operation;
+        u32 reg;
+        u32 value;
+    };
+
+    static constexpr u32 kAnyRegister = 0xFF;
+    static constexpr u32 kAnyValue = 0x100;
+
+    std::vector<Node> nodes;
+    std::vector<std::vector<u32>> pending{1};
+    std::vector<u32> edges;        // child nodes, each node's run sorted by key
+    std::vector<u32> edge_keys;
+    std::array<std::pair<u32, u32>, static_cast<std::size_t>(Operation::Count)> root_edges{};
+    std::vector<std::string> texts;
+    std::size_t longest = 0;
+
+    // `*` patterns sort last, under Operation::Count.
+    static constexpr u32 makeKey(u32 operation, u32 reg, u32 value) { return operation << 24 | reg << 16 | value; }
+
+    u32 edgeKey(u32 node) const {
+        using Match = InstructionPattern::Match;
+        const InstructionPattern& pattern = nodes[node].pattern;
+        u32 reg = kAnyRegister;
+        u32 value = kAnyValue;
+        if (pattern.operand_count != InstructionPattern::kAnyOperands) {
+            if (pattern.operand_count > 0 && pattern.operands[0].match == Match::Register) reg = static_cast<u32>(pattern.operands[0].reg);
+            for (u8 i = 0; i < pattern.operand_count; i++) {
+                if (pattern.operands[i].match == Match::Value) value = pattern.operands[i].value & 0xFF;
+            }
+        }
+        return makeKey(static_cast<u32>(pattern.operation), reg, value);
+    }
+
+    static RecordKey recordKey(const DecodedInstruction& instr) {
+        RecordKey key{static_cast<u32>(instr.operation), kAnyRegister, kAnyValue};
+        if (instr.operands[0].kind == OperandKind::Register) key.reg = instr.operands[0].value;
+        for (const Operand& operand : instr.operands) {
+            if (operand.kind == OperandKind::Immediate || operand.kind == OperandKind::SignedImmediate) key.value = instr.immediate & 0xFF;
+            if (operand.kind == OperandKind::Relative) key.value = getBranchTarget(instr) & 0xFF;
+        }
+        return key;
+    }
+
+    // Calls `take(child)` for every edge out of `node` whose key admits the
+    // record: its own register and value or open ones, then the `*` edges.
+    template<typename Take>
+    void forEachEdge(u32 node, const RecordKey& key, Take&& take) const {
+        const Node& from = nodes[node];
+        if (from.first_edge == from.last_edge) return;
+
+        auto visit = [this, &take](u32 begin, u32 end, u32 wanted) {
+            auto [lo, hi] = std::equal_range(edge_keys.begin() + begin, edge_keys.begin() + end, wanted);
+            for (auto it = lo; it != hi; ++it) take(edges[it - edge_keys.begin()]);
+        };
+
+        auto [begin, end] = (node == 0) ? root_edges[key.operation] : std::pair{from.first_edge, from.last_edge};
+        if (begin != end) {
+            const u32 regs[] = {key.reg, kAnyRegister};
+            const u32 values[] = {key.value, kAnyValue};
+            for (int r = (key.reg == kAnyRegister); r < 2; r++) {
+                for (int v = (key.value == kAnyValue); v < 2; v++) visit(begin, end, makeKey(key.operation, regs[r], values[v]));
+            }
+        }
+        visit(from.first_edge, from.last_edge, makeKey(static_cast<u32>(Operation::Count), kAnyRegister, kAnyValue));
+    }
+
+    static InstructionPattern parseInstruction(std::string_view text, std::string_view idiom) {
+        auto fail = [&idiom](const std::string& why) { return std::runtime_error("[ERROR] Bad idiom \"" + std::string(idiom) + "\": " + why); };
+
+        std::size_t comma = std::min(text.find(','), text.size());
+        std::vector<std::string_view> words = split(text.substr(0, comma), ' ');
+        InstructionPattern pattern;
+
+        std::size_t w = 0;
+        for (; w < words.size(); w++) {
+            if (words[w] == "lock") {
+                pattern.prefixes |= Prefix::Lock;
+            } else if (words[w] == "rep" || words[w] == "repe" || words[w] == "repz") {
+                pattern.prefixes |= Prefix::Rep;
+            } else if (words[w] == "repne" || words[w] == "repnz") {
+                pattern.prefixes |= Prefix::Repne;
+            } else {
+                break;
+            }
+        }
+        if (w == words.size()) throw fail("missing mnemonic in \"" + std::string(text) + "\"");
+
+        std::string mnemonic(words[w++]);
+        if ((mnemonic == "call" || mnemonic == "jmp") && w < words.size() && words[w] == "far") {
+            mnemonic += " far";
+            w++;
+        }
+        if (mnemonic != "*") {
+            pattern.operation = parseMnemonic(mnemonic, pattern.width);
+            if (pattern.operation == Operation::Count) throw fail("unknown mnemonic \"" + mnemonic + "\"");
+        }
+
+        // Whatever follows the mnemonic before the first comma is the first operand.
+        std::vector<std::string_view> operands;
+        if (w < words.size()) {
+            std::size_t first = words[w].data() - text.data();
+            operands = split(text.substr(first), ',');
+        } else if (comma < text.size()) {
+            throw fail("missing first operand in \"" + std::string(text) + "\"");
+        }
+        if (operands.size() > 2) throw fail("more than two operands in \"" + std::string(text) + "\"");
+
+        if (!operands.empty()) {
+            if (pattern.operation == Operation::Count) throw fail("`*` takes no operands");
+            pattern.operand_count = static_cast<u8>(operands.size());
+            for (std::size_t i = 0; i < operands.size(); i++) {
+                if (!parseOperand(operands[i], pattern.operands[i])) throw fail("unknown operand \"" + std::string(operands[i]) + "\"");
+            }
+        }
+        return pattern;
+    }
+
+    static Operation parseMnemonic(const std::string& mnemonic, u8& width) {
+        static constexpr std::pair<std::string_view, Operation> kAliases[] = {
+            {"jz", Operation::Je}, {"jnz", Operation::Jne}, {"jc", Operation::Jb}, {"jnae", Operation::Jb},
+            {"jnc", Operation::Jnb}, {"jae", Operation::Jnb}, {"jna", Operation::Jbe}, {"ja", Operation::Jnbe},
+            {"jpe", Operation::Jp}, {"jpo", Operation::Jnp}, {"jnge", Operation::Jl}, {"jge", Operation::Jnl},
+            {"jng", Operation::Jle}, {"jg", Operation::Jnle}, {"loopz", Operation::Loope}, {"loopnz", Operation::Loopne},
+            {"shl", Operation::Sal},
+        };
+
+        for (std::size_t op = 2; op < static_cast<std::size_t>(Operation::Count); op++) {
+            if (mnemonics[op] == mnemonic) return static_cast<Operation>(op);
+        }
+        for (auto [alias, operation] : kAliases) {
+            if (alias == mnemonic) return operation;
+        }
+
+        // movsb, stosw, ...
+        std::string_view base = std::string_view(mnemonic).substr(0, mnemonic.size() - 1);
+        char suffix = mnemonic.empty() ? 0 : mnemonic.back();
+        for (std::size_t op = 2; op < static_cast<std::size_t>(Operation::Count); op++) {
+            Operation operation = static_cast<Operation>(op);
+            if (isStringOp(operation) && mnemonics[op] == base && (suffix == 'b' || suffix == 'w')) {
+                width = (suffix == 'b') ? 1 : 2;
+                return operation;
+            }
+        }
+        return Operation::Count;
+    }
+
+    static bool parseOperand(std::string_view text, InstructionPattern::OperandPattern& operand) {
+        using Match = InstructionPattern::Match;
+
+        if (text == "*") return operand.match = Match::Any, true;
+        if (text == "reg") return operand.match = Match::AnyRegister, true;
+        if (text == "mem") return operand.match = Match::AnyMemory, true;
+        if (text == "imm") return operand.match = Match::AnyImmediate, true;
+
+        for (std::size_t r = 0; r < std::size(registerNames); r++) {
+            if (registerNames[r] == text) {
+                operand.match = Match::Register;
+                operand.reg = static_cast<Register>(r);
+                return true;
+            }
+        }
+
+        // 33, -1, 0x21 or 21h.
+        bool negative = text.starts_with('-');
+        if (negative) text.remove_prefix(1);
+        int base = 10;
+        if (text.starts_with("0x")) {
+            text.remove_prefix(2);
+            base = 16;
+        } else if (text.ends_with('h')) {
+            text.remove_suffix(1);
+            base = 16;
+        }
+        u32 value = 0;
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, base);
+        if (text.empty() || error != std::errc() || end != text.data() + text.size() || value > 0xFFFF) return false;
+
+        operand.match = Match::Value;
+        operand.value = negative ? -static_cast<int>(value) : static_cast<int>(value);
+        return true;
+    }
+
+    // Non-empty pieces of `text` between `separator`s, trimmed of blanks.
+    static std::vector<std::string_view> split(std::string_view text, char separator) {
+        std::vector<std::string_view> pieces;
+        std::size_t start = 0;
+        while (start <= text.size()) {
+            std::size_t end = std::min(text.find(separator, start), text.size());
+            std::string_view piece = text.substr(start, end - start);
+            while (!piece.empty() && std::isspace(static_cast<unsigned char>(piece.front()))) piece.remove_prefix(1);
+            while (!piece.empty() && std::isspace(static_cast<unsigned char>(piece.back()))) piece.remove_suffix(1);
+            if (!piece.empty() || separator == ',') pieces.push_back(piece);
+            start = end + 1;
+        }
+        return pieces;
+    }
+};
+
+// Runs an IdiomSet over a stream of records in one pass. The active nodes
+// are the trie nodes reached by the records just seen; every record steps
+// each of them, and the root, along the edges it matches. A node is only
+// reached from one start position, so the set never holds duplicates and
+// stays no larger than the trie is deep times its fan-out. The last records
+// are kept in a ring long enough for the longest idiom.
+class IdiomMatcher {
+public:
+    explicit IdiomMatcher(const IdiomSet& set)
+        : set(set), history(std::bit_ceil(std::max<std::size_t>(set.longestIdiom(), 1))), mask(history.size() - 1) {}
+
+    // Calls `found(idiom, length)` for every idiom that ends at `instr`; its
+    // records are recent(length - 1) .. recent(0).
+    template<typename Found>
+    void step(const DecodedInstruction& instr, Found&& found) {
+        history[seen++ & mask] = instr;
+
+        IdiomSet::RecordKey key = IdiomSet::recordKey(instr);
+        auto take = [&](u32 child) {
+            const IdiomSet::Node& node = set.nodes[child];
+            if (!node.pattern.matches(instr)) return;
+            for (u32 idiom : node.idioms) found(idiom, node.depth);
+            if (node.first_edge != node.last_edge) next.push_back(child);
+        };
+
+        next.clear();
+        set.forEachEdge(0, key, take);
+        for (u32 node : active) set.forEachEdge(node, key, take);
+        active.swap(next);
+    }
+
+    // The record `back` records before the latest one.
+    const DecodedInstruction& recent(std::size_t back) const { return history[(seen - 1 - back) & mask]; }
+
+private:
+    const IdiomSet& set;
+    std::vector<DecodedInstruction> history;
+    std::size_t mask;
+    std::size_t seen = 0;
+    std::vector<u32> active;
+    std::vector<u32> next;
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "decoder.h"
+#include "instruction.h"
+
+// A byte replacement: `old_length` bytes at `offset` become `bytes`.
+struct Patch {
+    std::size_t offset;
+    std::size_t old_length;
+    std::vector<u8> bytes;
+};
+
+// Records that a patch replaced: [first, first + removed) of the old stream
+// became [first, first + inserted) of the new one, covering image bytes
+// [begin, end) after the patch. Records after them only moved by the size change.
+struct PatchResult {
+    std::size_t first;
+    std::size_t removed;
+    std::size_t inserted;
+    std::size_t begin;
+    std::size_t end;
+};
+
+// Keeps an image and its linear-sweep decode in step across patches. A patch
+// re-decodes from the start of the first record the edit could change (the
+// one it overlaps, or a prefix-only record whose length depends on the next
+// byte) until a new record starts where an old one did past the edit: from
+// there on the bytes, and so the records, are the old ones shifted by the
+// size change. The cost is the re-decoded window plus, when the size changes,
+// one pass moving the later offsets.
+class IncrementalDecoder {
+public:
+    IncrementalDecoder(std::vector<u8> image) : image(std::move(image)) {
+        PatchResult ignored;
+        decodeFrom(0, 0, 0, 0, ignored);
+    }
+
+    std::span<const u8> bytes() const { return image; }
+
+    std::span<const DecodedInstruction> instructions() const { return records; }
+
+    // True when the image ends inside an instruction, which starts at truncatedAt().
+    bool truncated() const { return truncated_at < image.size(); }
+    std::size_t truncatedAt() const { return truncated_at; }
+
+    PatchResult apply(const Patch& patch) {
+        if (patch.offset > image.size() || patch.old_length > image.size() - patch.offset) {
+            throw std::runtime_error("[ERROR] Patch outside the image.");
+        }
+
+        std::ptrdiff_t delta = static_cast<std::ptrdiff_t>(patch.bytes.size()) - static_cast<std::ptrdiff_t>(patch.old_length);
+        image.erase(image.begin() + patch.offset, image.begin() + patch.offset + patch.old_length);
+        image.insert(image.begin() + patch.offset, patch.bytes.begin(), patch.bytes.end());
+
+        // The first record whose decode can see the edited bytes. The last
+        // byte each record depends on only grows along the stream.
+        auto affected = std::partition_point(records.begin(), records.end(), [&](const DecodedInstruction& instr) {
+            std::size_t seen = instr.offset + instr.length + ((instr.flags & InstructionFlags::PrefixOnly) ? 1 : 0);
+            return seen <= patch.offset;
+        });
+        std::size_t first = affected - records.begin();
+        std::size_t start = (affected == records.end()) ? std::min(truncated_at, patch.offset) : affected->offset;
+
+        PatchResult result;
+        decodeFrom(first, start, patch.offset + patch.bytes.size(), delta, result);
+        return result;
+    }
+
+private:
+    std::vector<u8> image;
+    std::vector<DecodedInstruction> records;
+    std::size_t truncated_at = 0;
+
+    // Replaces records[first..] with a decode from `start` that stops at the
+    // first record at or past `resume` which starts where an old record did,
+    // shifted by `delta`.
+    void decodeFrom(std::size_t first, std::size_t start, std::size_t resume, std::ptrdiff_t delta, PatchResult& result) {
+        std::vector<DecodedInstruction> fresh;
+        std::size_t old = first;
+        std::size_t converged = SIZE_MAX;
+
+        InstructionDecoder decoder(std::span<const u8>(image).subspan(start), start);
+        std::array<DecodedInstruction, 256> batch;
+        std::size_t end = image.size();
+
+        while (converged == SIZE_MAX) {
+            std::size_t count = decoder.decode(batch.data(), batch.size());
+            if (!count) break;
+
+            for (std::size_t i = 0; i < count; i++) {
+                std::size_t offset = batch[i].offset;
+                if (offset >= resume) {
+                    while (old < records.size() && static_cast<std::ptrdiff_t>(records[old].offset) + delta < static_cast<std::ptrdiff_t>(offset)) old++;
+                    if (old < records.size() && static_cast<std::ptrdiff_t>(records[old].offset) + delta == static_cast<std::ptrdiff_t>(offset)) {
+                        converged = old;
+                        end = offset;
+                        break;
+                    }
+                }
+                fresh.push_back(batch[i]);
+            }
+        }
+        bool failed = decoder.truncated();
+
+        std::size_t removed = ((converged == SIZE_MAX) ? records.size() : converged) - first;
+        result = {first, removed, fresh.size(), start, end};
+
+        // Past convergence the old tail, truncated or not, is only shifted.
+        if (converged != SIZE_MAX) {
+            truncated_at += delta;
+        } else if (failed) {
+            truncated_at = fresh.empty() ? start : fresh.back().offset + fresh.back().length;
+        } else {
+            truncated_at = image.size();
+        }
+
+        if (delta != 0) {
+            for (std::size_t i = first + removed; i < records.size(); i++) records[i].offset += delta;
+        }
+
+        if (fresh.size() == removed) {
+            std::copy(fresh.begin(), fresh.end(), records.begin() + first);
+        } else {
+            records.erase(records.begin() + first, records.begin() + first + removed);
+            records.insert(records.begin() + first, fresh.begin(), fresh.end());
+        }
+    }
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "instruction.h"
+
+// Input opened for decoding. Regular files are mapped read-only; anything
+// else (stdin as "-", pipes, devices) is left to be read through ChunkReader.
+class InputFile {
+public:
+    InputFile(const std::string& filename) {
+        if (filename == "-") {
+            fd = STDIN_FILENO;
+        } else {
+            fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("[ERROR] Cannot open file: " + filename);
+            }
+            owns_fd = true;
+        }
+
+        struct stat st;
+        bool have_stat = ::fstat(fd, &st) == 0;
+        if (have_stat) {
+            regular = S_ISREG(st.st_mode);
+            modified_ns = u64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        }
+        if (have_stat && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                ::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+                mapping = static_cast<const u8*>(addr);
+                mapping_size = st.st_size;
+            }
+        }
+    }
+
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+
+    ~InputFile() {
+        if (mapping) ::munmap(const_cast<u8*>(mapping), mapping_size);
+        if (owns_fd) ::close(fd);
+    }
+
+    bool isMapped() const { return mapping != nullptr; }
+
+    // A regular file, even an empty one that has no mapping.
+    bool isRegular() const { return regular; }
+
+    std::span<const u8> bytes() const { return {mapping, mapping_size}; }
+
+    int descriptor() const { return fd; }
+
+    // Modification time in nanoseconds, 0 if unknown.
+    u64 modified() const { return modified_ns; }
+
+private:
+    int fd = -1;
+    u64 modified_ns = 0;
+    bool owns_fd = false;
+    bool regular = false;
+    const u8* mapping = nullptr;
+    std::size_t mapping_size = 0;
+};
+
+// Reads a descriptor through one fixed window so memory stays constant
+// whatever the input size. Bytes the caller has not consumed yet (a partial
+// instruction at the end of a window) are carried to the front of the next one.
+class ChunkReader {
+public:
+    ChunkReader(int fd, std::size_t window_size = 1 << 20) : fd(fd), buffer(window_size) {}
+
+    // Drops the first `consumed` bytes of the current window and refills it.
+    std::span<const u8> next(std::size_t consumed) {
+        std::size_t carry = size - consumed;
+        std::memmove(buffer.data(), buffer.data() + consumed, carry);
+        origin_offset += consumed;
+        size = carry;
+
+        while (!at_eof && size < buffer.size()) {
+            ssize_t count = ::read(fd, buffer.data() + size, buffer.size() - size);
+            if (count < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("[ERROR] Cannot read input.");
+            }
+            if (count == 0) at_eof = true;
+            size += count;
+        }
+
+        return {buffer.data(), size};
+    }
+
+    // Absolute input offset of the first byte in the current window.
+    std::size_t origin() const { return origin_offset; }
+
+    bool eof() const { return at_eof; }
+
+private:
+    int fd;
+    std::vector<u8> buffer;
+    std::size_t size = 0;
+    std::size_t origin_offset = 0;
+    bool at_eof = false;
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <string_view>
+#include <type_traits>
+
+using u8 = uint8_t;
+using u16 = uint16_t;
+using u32 = uint32_t;
+using u64 = uint64_t;
+
+using i8 = int8_t;
+using i16 = int16_t;
+
+enum class Operation : u8 {
+    None, Unknown,
+    Add, Or, Adc, Sbb, And, Sub, Xor, Cmp,
+    Test, Mov, Xchg, Lea, Les, Lds, Push, Pop,
+    Inc, Dec, Not, Neg, Mul, Imul, Div, Idiv,
+    Rol, Ror, Rcl, Rcr, Sal, Shr, Sar,
+    Daa, Das, Aaa, Aas, Aam, Aad, Cbw, Cwd, Xlat,
+    Wait, Pushf, Popf, Sahf, Lahf, Hlt, Cmc, Clc, Stc, Cli, Sti, Cld, Std,
+    Movs, Cmps, Stos, Lods, Scas,
+    In, Out, Int, Int3, Into, Iret,
+    Ret, Retf, Call, CallFar, Jmp, JmpFar,
+    Jo, Jno, Jb, Jnb, Je, Jne, Jbe, Jnbe, Js, Jns, Jp, Jnp, Jl, Jnl, Jle, Jnle,
+    Loopne, Loope, Loop, Jcxz,
+    Esc,
+    Count
+};
+
+enum class Register : u8 {
+    Al, Cl, Dl, Bl, Ah, Ch, Dh, Bh,
+    Ax, Cx, Dx, Bx, Sp, Bp, Si, Di,
+    Es, Cs, Ss, Ds
+};
+
+// Memory operand forms, in ModRM rm order; Direct is the [disp16] form.
+enum class EffectiveAddress : u8 {
+    BxSi, BxDi, BpSi, BpDi, Si, Di, Bp, Bx, Direct
+};
+
+enum class OperandKind : u8 {
+    None,
+    Register,        // value: Register
+    Memory,          // value: EffectiveAddress, displacement holds disp16 or the direct address
+    Immediate,       // value: encoded size in bytes (0 when implied), printed unsigned
+    SignedImmediate, // value: encoded size in bytes, printed signed
+    Relative,        // value: encoded size in bytes, displacement holds the sign-extended offset
+    Far              // immediate holds the segment, displacement the offset
+};
+
+struct Operand {
+    OperandKind kind;
+    u8 value;
+};
+
+namespace Prefix {
+    constexpr u8 Lock = 1 << 0;
+    constexpr u8 Rep = 1 << 1;
+    constexpr u8 Repne = 1 << 2;
+    constexpr u8 Segment = 1 << 3;
+}
+
+namespace InstructionFlags {
+    constexpr u8 Wide = 1 << 0;           // operates on words
+    constexpr u8 HasModRM = 1 << 1;
+    constexpr u8 SizedMemory = 1 << 2;    // memory operand needs an explicit byte/word
+    constexpr u8 SizedImmediate = 1 << 3; // immediate operand needs an explicit byte/word
+    constexpr u8 PrefixOnly = 1 << 4;     // prefixes not followed by an instruction
+}
+
+// Longest record the decoder produces: three folded prefixes and a six byte instruction.
+constexpr std::size_t kMaxInstructionLength = 9;
+
+// One decoded instruction. Prefixes are folded into the instruction they
+// apply to, so offset/length cover the prefix bytes as well.
+struct DecodedInstruction {
+    std::size_t offset;
+    i16 displacement;
+    u16 immediate;
+    Operation operation;
+    u8 opcode;
+    u8 modrm;
+    u8 length;
+    u8 prefixes;
+    Register segment;
+    u8 flags;
+    Operand operands[2];
+};
+
+static_assert(std::is_trivial_v<DecodedInstruction> && std::is_standard_layout_v<DecodedInstruction>);
+static_assert(sizeof(DecodedInstruction) == 24);
+
+constexpr std::string_view mnemonics[] = {
+    "", "",
+    "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp",
+    "test", "mov", "xchg", "lea", "les", "lds", "push", "pop",
+    "inc", "dec", "not", "neg", "mul", "imul", "div", "idiv",
+    "rol", "ror", "rcl", "rcr", "sal", "shr", "sar",
+    "daa", "das", "aaa", "aas", "aam", "aad", "cbw", "cwd", "xlat",
+    "wait", "pushf", "popf", "sahf", "lahf", "hlt", "cmc", "clc", "stc", "cli", "sti", "cld", "std",
+    "movs", "cmps", "stos", "lods", "scas",
+    "in", "out", "int", "int3", "into", "iret",
+    "ret", "retf", "call", "call far", "jmp", "jmp far",
+    "jo", "jno", "jb", "jnb", "je", "jne", "jbe", "jnbe", "js", "jns", "jp", "jnp", "jl", "jnl", "jle", "jnle",
+    "loopne", "loope", "loop", "jcxz",
+    "esc"
+};
+static_assert(std::size(mnemonics) == static_cast<std::size_t>(Operation::Count));
+
+constexpr std::string_view registerNames[] = {
+    "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh",
+    "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+    "es", "cs", "ss", "ds"
+};
+
+inline std::string_view getMnemonic(Operation operation) {
+    return mnemonics[static_cast<u8>(operation)];
+}
+
+inline std::string_view getRegisterName(Register reg) {
+    return registerNames[static_cast<u8>(reg)];
+}
+
+inline Register getRegister(u8 reg, u8 w) {
+    return static_cast<Register>(w ? reg + 8 : reg);
+}
+
+inline Register getSegReg(u8 segReg) {
+    return static_cast<Register>(static_cast<u8>(Register::Es) + segReg);
+}
+
+inline bool isStringOp(Operation operation) {
+    return operation >= Operation::Movs && operation <= Operation::Scas;
+}
+
+// How an instruction passes control on, as far as it can be known statically.
+enum class ControlFlow : u8 {
+    Next,       // falls through to the following instruction
+    Branch,     // conditional: relative target or fall through
+    Jump,       // relative target only
+    Call,       // relative target is a procedure; execution resumes after it
+    Stop,       // ret, iret, hlt, far or indirect jumps: no known successor
+};
+
+inline ControlFlow getControlFlow(const DecodedInstruction& instr) {
+    bool relative = instr.operands[0].kind == OperandKind::Relative;
+
+    switch (instr.operation) {
+        case Operation::Jo: case Operation::Jno: case Operation::Jb: case Operation::Jnb:
+        case Operation::Je: case Operation::Jne: case Operation::Jbe: case Operation::Jnbe:
+        case Operation::Js: case Operation::Jns: case Operation::Jp: case Operation::Jnp:
+        case Operation::Jl: case Operation::Jnl: case Operation::Jle: case Operation::Jnle:
+        case Operation::Loopne: case Operation::Loope: case Operation::Loop: case Operation::Jcxz:
+            return ControlFlow::Branch;
+        case Operation::Jmp:
+            return relative ? ControlFlow::Jump : ControlFlow::Stop;
+        case Operation::Call:
+            return relative ? ControlFlow::Call : ControlFlow::Next;
+        case Operation::JmpFar: case Operation::Ret: case Operation::Retf:
+        case Operation::Iret: case Operation::Hlt:
+            return ControlFlow::Stop;
+        default:
+            return ControlFlow::Next;
+    }
+}
+
+// The number an immediate operand is written as, which the formatter prints
+// and the encoder assembles from. A byte sign-extended to a word (83) is
+// already extended in the record, so it is written as the 16-bit value.
+inline int getImmediateValue(const DecodedInstruction& instr, const Operand& operand) {
+    if (operand.kind == OperandKind::SignedImmediate) {
+        return (operand.value == 1) ? static_cast<i8>(instr.immediate) : static_cast<i16>(instr.immediate);
+    }
+    return instr.immediate;
+}
+
+// Target of a relative branch. IP wraps within the 64 KB segment the
+// instruction was decoded in.
+inline std::size_t getBranchTarget(const DecodedInstruction& instr) {
+    std::size_t next = instr.offset + instr.length;
+    return (next & ~std::size_t(0xFFFF)) | static_cast<u16>(next + instr.displacement);
+}
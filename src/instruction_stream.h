@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <iterator>
+#include <span>
+
+#include "decoder.h"
+#include "instruction.h"
+
+// Hands out the records of an input one at a time, for callers that walk
+// instructions in a loop rather than in batches. Records are decoded a batch
+// at a time into a buffer the stream owns, so next() is a copy-free pointer
+// bump between batches. reset() starts over on another input without
+// allocating; a stream is one thread's, and streams share nothing.
+//
+//     InstructionStream stream(code);
+//     for (const DecodedInstruction& instr : stream) { ... }
+//     if (stream.truncated()) { ... stream.position() ... }
+class InstructionStream {
+public:
+    InstructionStream() : decoder({}) {}
+
+    // `origin` and `final` are as for InstructionDecoder.
+    explicit InstructionStream(std::span<const u8> code, std::size_t origin = 0, bool final = true)
+        : decoder(code, origin, final), origin(origin) {}
+
+    void reset(std::span<const u8> code, std::size_t origin = 0, bool final = true) {
+        decoder = InstructionDecoder(code, origin, final);
+        this->origin = origin;
+        index = count = 0;
+    }
+
+    // The next record, or nullptr at the end of the input or at an
+    // instruction that runs past it.
+    const DecodedInstruction* next() {
+        if (index == count) {
+            count = decoder.decode(batch.data(), batch.size());
+            index = 0;
+            if (!count) return nullptr;
+        }
+        return &batch[index++];
+    }
+
+    // True once the stream stopped at an instruction cut off by the end of the input.
+    bool truncated() const { return index == count && decoder.truncated(); }
+
+    const Truncation& truncation() const { return decoder.truncation(); }
+
+    // Input offset of the next record, or where the stream stopped.
+    std::size_t position() const { return (index < count) ? batch[index].offset : origin + decoder.position(); }
+
+    class Iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = DecodedInstruction;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const DecodedInstruction*;
+        using reference = const DecodedInstruction&;
+
+        Iterator() = default;
+        Iterator(InstructionStream* stream) : stream(stream), current(stream->next()) {}
+
+        reference operator*() const { return *current; }
+        pointer operator->() const { return current; }
+
+        Iterator& operator++() {
+            current = stream->next();
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const { return current == nullptr; }
+
+    private:
+        InstructionStream* stream = nullptr;
+        const DecodedInstruction* current = nullptr;
+    };
+
+    Iterator begin() { return Iterator(this); }
+    std::default_sentinel_t end() { return {}; }
+
+private:
+    InstructionDecoder decoder;
+    std::size_t origin = 0;
+    std::size_t index = 0;
+    std::size_t count = 0;
+    std::array<DecodedInstruction, 256> batch;
+};
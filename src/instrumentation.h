@@ -0,0 +1,205 @@
+#pragma once
+
+// Hot-path counters for the decoder and formatter, compiled in only with
+// -DINSTRUMENT (`./build.sh instrument`). Without it INSTRUMENT_ONLY drops its
+// argument, so a normal build carries no trace of them.
+//
+// Counts are kept per thread and merged at exit, when a JSON summary is
+// written to the file named by SIM8086_STATS, or to stderr. Handler and
+// format timings are sampled: one call in kSampleInterval is timed with the
+// time stamp counter and the total is extrapolated from the samples.
+#ifdef INSTRUMENT
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include "instruction.h"
+#include "opcode_table.h"
+
+#define INSTRUMENT_ONLY(...) __VA_ARGS__
+
+namespace Instrumentation {
+    constexpr std::size_t kHandlerCount = static_cast<std::size_t>(Handler::NullaryInstruction) + 1;
+    constexpr u64 kSampleInterval = 64;
+
+    constexpr const char* kHandlerNames[kHandlerCount] = {
+        "unknownOpcode", "decodeXchgRegMem", "decodeRegMem", "decodeRets", "decodeLoads", "decodeRegSegReg",
+        "decodeMovAccMem", "decodeXchgAccMem", "decodeAccMem", "decodeStrOps", "decodeIncDec",
+        "decodeSegRegPushPop", "decodePushPop", "decodeConJmp", "decodeImmRegMem", "decodeInOut",
+        "decodeControlTransfer", "decodeGrp3", "decodeGrp5", "decodeRegMem16", "decodeImmToReg",
+        "decodeImmToMem", "decodeInt", "decodeShtRot", "decodeESC", "decodeLoop",
+        "decodeNullaryInstructionTwoBytes", "decodeNullaryInstruction",
+    };
+    constexpr const char* kPrefixNames[] = {"lock", "rep", "repne", "segment"};
+    constexpr const char* kOperandNames[] = {"none", "register", "memory", "immediate", "signed_immediate", "relative", "far"};
+
+    struct Timer {
+        u64 calls = 0;
+        u64 samples = 0;
+        u64 cycles = 0;
+    };
+
+    struct Counters {
+        std::array<u64, 256> opcodes{};
+        std::array<Timer, kHandlerCount> handlers{};
+        std::array<u64, 32> modrm_forms{};   // mod * 8 + rm
+        std::array<u64, 4> prefixes{};        // in Prefix bit order
+        std::array<u64, 7> operands{};        // formatted operands by OperandKind
+        u64 one_byte_run_records = 0;
+        u64 prefix_only_records = 0;
+        u64 unknown_opcodes = 0;
+        Timer format;
+        u64 tick = 0;
+
+        void merge(const Counters& other) {
+            auto add = [](auto& into, const auto& from) {
+                for (std::size_t i = 0; i < into.size(); i++) into[i] += from[i];
+            };
+            add(opcodes, other.opcodes);
+            add(modrm_forms, other.modrm_forms);
+            add(prefixes, other.prefixes);
+            add(operands, other.operands);
+            for (std::size_t i = 0; i < kHandlerCount; i++) addTimer(handlers[i], other.handlers[i]);
+            addTimer(format, other.format);
+            one_byte_run_records += other.one_byte_run_records;
+            prefix_only_records += other.prefix_only_records;
+            unknown_opcodes += other.unknown_opcodes;
+        }
+
+        static void addTimer(Timer& into, const Timer& from) {
+            into.calls += from.calls;
+            into.samples += from.samples;
+            into.cycles += from.cycles;
+        }
+    };
+
+    inline u64 now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    // Owns every thread's counters, so counts outlive their threads, and
+    // writes the merged summary when the program exits.
+    class Registry {
+    public:
+        Counters& add() {
+            std::lock_guard guard(lock);
+            all.push_back(std::make_unique<Counters>());
+            return *all.back();
+        }
+
+        ~Registry() { report(); }
+
+    private:
+        std::mutex lock;
+        std::vector<std::unique_ptr<Counters>> all;
+
+        static void putTimer(std::FILE* out, const char* name, const Timer& timer, bool last) {
+            double per_call = timer.samples ? double(timer.cycles) / timer.samples : 0;
+            std::fprintf(out, "    \"%s\": {\"calls\": %llu, \"sampled\": %llu, \"cycles_per_call\": %.1f, \"estimated_cycles\": %.0f}%s\n",
+                         name, (unsigned long long)timer.calls, (unsigned long long)timer.samples, per_call, per_call * timer.calls,
+                         last ? "" : ",");
+        }
+
+        template<std::size_t N>
+        static void putCounts(std::FILE* out, const char* name, const std::array<u64, N>& counts, const char* const* names, bool last) {
+            std::fprintf(out, "  \"%s\": {", name);
+            bool first = true;
+            for (std::size_t i = 0; i < N; i++) {
+                if (!counts[i]) continue;
+                if (names) {
+                    std::fprintf(out, "%s\"%s\": %llu", first ? "" : ", ", names[i], (unsigned long long)counts[i]);
+                } else {
+                    std::fprintf(out, "%s\"0x%02zx\": %llu", first ? "" : ", ", i, (unsigned long long)counts[i]);
+                }
+                first = false;
+            }
+            std::fprintf(out, "}%s\n", last ? "" : ",");
+        }
+
+        void report() {
+            Counters total;
+            for (const auto& counters : all) total.merge(*counters);
+
+            const char* path = std::getenv("SIM8086_STATS");
+            std::FILE* out = path ? std::fopen(path, "w") : stderr;
+            if (!out) return;
+
+            std::fprintf(out, "{\n  \"threads\": %zu,\n", all.size());
+            std::fprintf(out, "  \"one_byte_run_records\": %llu,\n", (unsigned long long)total.one_byte_run_records);
+            std::fprintf(out, "  \"prefix_only_records\": %llu,\n", (unsigned long long)total.prefix_only_records);
+            std::fprintf(out, "  \"unknown_opcodes\": %llu,\n", (unsigned long long)total.unknown_opcodes);
+            putCounts(out, "opcodes", total.opcodes, nullptr, false);
+            putCounts(out, "prefixes", total.prefixes, kPrefixNames, false);
+
+            std::fprintf(out, "  \"modrm_forms\": {");
+            bool first = true;
+            for (std::size_t i = 0; i < total.modrm_forms.size(); i++) {
+                if (!total.modrm_forms[i]) continue;
+                std::fprintf(out, "%s\"mod%zu_rm%zu\": %llu", first ? "" : ", ", i / 8, i % 8, (unsigned long long)total.modrm_forms[i]);
+                first = false;
+            }
+            std::fprintf(out, "},\n");
+
+            putCounts(out, "formatted_operands", total.operands, kOperandNames, false);
+
+            std::fprintf(out, "  \"handlers\": {\n");
+            std::size_t used = 0;
+            for (const Timer& timer : total.handlers) used += timer.calls != 0;
+            for (std::size_t i = 0; i < kHandlerCount; i++) {
+                if (total.handlers[i].calls) putTimer(out, kHandlerNames[i], total.handlers[i], --used == 0);
+            }
+            std::fprintf(out, "  },\n  \"format\": {\n");
+            putTimer(out, "format", total.format, true);
+            std::fprintf(out, "  }\n}\n");
+
+            if (out != stderr) std::fclose(out);
+        }
+    };
+
+    inline Registry registry;
+
+    inline Counters& local() {
+        thread_local Counters& counters = registry.add();
+        return counters;
+    }
+
+    // Counts one call; every kSampleInterval-th call on a thread is also timed.
+    class Sample {
+    public:
+        Sample(Timer& timer) : timer(timer) {
+            Counters& counters = local();
+            timer.calls++;
+            if (++counters.tick % kSampleInterval == 0) start = now();
+        }
+
+        ~Sample() {
+            if (!start) return;
+            timer.cycles += now() - start;
+            timer.samples++;
+        }
+
+    private:
+        Timer& timer;
+        u64 start = 0;
+    };
+}
+
+#else
+
+#define INSTRUMENT_ONLY(...)
+
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include <vector>
+
+#include "instruction.h"
+#include "length_decoder.h"
+
+// Offsets that get a label: relative branch, call and loop targets that land
+// on the start of a decoded record. One bit per image byte keeps the lookup
+// during formatting O(1). Filled by a first pass over every record.
+class LabelIndex {
+public:
+    LabelIndex(std::size_t size) : starts((size + 63) / 64), targets((size + 63) / 64) {}
+
+    void add(const DecodedInstruction& instr) {
+        set(starts, instr.offset);
+
+        ControlFlow flow = getControlFlow(instr);
+        if (flow == ControlFlow::Branch || flow == ControlFlow::Jump || flow == ControlFlow::Call) {
+            set(targets, getBranchTarget(instr));
+        }
+    }
+
+    void add(std::span<const DecodedInstruction> batch) {
+        for (const DecodedInstruction& instr : batch) add(instr);
+    }
+
+    // Linear-sweep first pass. Walks record lengths only and reads the
+    // displacement of relative branches straight from the image, which
+    // costs far less than decoding every record twice. `origin` is the
+    // offset of code[0], as given to the decoder.
+    void collect(std::span<const u8> code, std::size_t origin = 0) {
+        LengthDecoder decoder(code);
+        std::array<u8, 4096> lengths;
+        std::size_t pos = 0;
+
+        while (std::size_t count = decoder.lengths(lengths.data(), lengths.size())) {
+            for (std::size_t i = 0; i < count; i++) {
+                std::size_t next = pos + lengths[i];
+                set(starts, origin + pos);
+
+                std::size_t opcode = pos;
+                while (opcode + 1 < next && isPrefixOpcode(code[opcode])) opcode++;
+
+                u8 size = kRelativeSizes[code[opcode]];
+                if (size) {
+                    i16 displacement = (size == 1) ? static_cast<i8>(code[next - 1]) : static_cast<i16>(code[next - 2] | code[next - 1] << 8);
+                    std::size_t end = origin + next;
+                    set(targets, (end & ~std::size_t(0xFFFF)) | static_cast<u16>(end + displacement));
+                }
+                pos = next;
+            }
+        }
+
+        finish();
+    }
+
+    // Drops targets that fall inside a record or outside the image; their
+    // operands keep the `$`-relative or numeric form.
+    void finish() {
+        for (std::size_t i = 0; i < targets.size(); i++) targets[i] &= starts[i];
+    }
+
+    bool contains(std::size_t offset) const {
+        return offset / 64 < targets.size() && (targets[offset / 64] >> (offset % 64)) & 1;
+    }
+
+private:
+    // Size of the relative operand that ends jcc, loop, jmp and call records.
+    static constexpr std::array<u8, 256> kRelativeSizes = []() {
+        std::array<u8, 256> t{};
+        for (int i = 0x70; i <= 0x7F; i++) t[i] = 1;
+        for (int i = 0xE0; i <= 0xE3; i++) t[i] = 1;
+        t[0xE8] = 2;
+        t[0xE9] = 2;
+        t[0xEB] = 1;
+        return t;
+    }();
+
+    std::vector<u64> starts;
+    std::vector<u64> targets;
+
+    static void set(std::vector<u64>& bits, std::size_t offset) {
+        if (offset / 64 < bits.size()) bits[offset / 64] |= u64(1) << (offset % 64);
+    }
+};
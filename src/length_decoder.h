@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <span>
+
+#include "instruction.h"
+#include "length_rules.h"
+#include "opcode_classifier.h"
+
+// Finds instruction boundaries without decoding operands. Window, origin and
+// prefix folding follow InstructionDecoder exactly, so both always agree on
+// where records start and how long they are.
+class LengthDecoder {
+public:
+    LengthDecoder(std::span<const u8> code, std::size_t origin = 0, bool final = true)
+        : code(code), origin(origin), runs(code) {
+        // A non-final window too short for one whole instruction decodes nothing.
+        limit = final ? code.size() : code.size() - std::min(code.size(), kMaxInstructionLength - 1);
+    }
+
+    // Length of the record starting at `pos`, or 0 if it runs past the end of `code`.
+    static std::size_t instructionLength(std::span<const u8> code, std::size_t pos) {
+        std::size_t start = pos;
+        u8 rule = kLengthRules[code[pos]];
+
+        if (rule & LengthRule::PrefixGroup) {
+            u8 last_group = 0;
+            while (pos < code.size()) {
+                u8 group = (kLengthRules[code[pos]] & LengthRule::PrefixGroup) >> 5;
+                if (!group || group <= last_group) break;
+                last_group = group;
+                pos++;
+            }
+
+            if (pos == code.size() || (kLengthRules[code[pos]] & LengthRule::PrefixGroup)) {
+                return pos - start;
+            }
+            rule = kLengthRules[code[pos]];
+        }
+
+        std::size_t length = 1 + (rule & LengthRule::ExtraBytes);
+        if (rule & LengthRule::HasModRM) {
+            if (pos + 1 >= code.size()) return 0;
+
+            u8 modrm = code[pos + 1];
+            length += 1 + kDisplacementLengths[modrm];
+            if ((rule & LengthRule::TestImmediate) && ((modrm >> 3) & 7) == 0) {
+                length += (code[pos] & 1) ? 2 : 1;
+            }
+        }
+
+        if (pos + length > code.size()) return 0;
+        return pos + length - start;
+    }
+
+    // Writes the absolute start offset of up to `capacity` instructions into `out`.
+    // Returns how many were written; stops early at a truncated instruction.
+    std::size_t boundaries(std::size_t* out, std::size_t capacity) {
+        std::size_t count = 0;
+        while (count < capacity && pc < limit) {
+            if (isOneByteOpcode(code[pc])) {
+                std::size_t run = runs.oneByteRun(pc, std::min(capacity - count, limit - pc));
+                for (std::size_t i = 0; i < run; i++) out[count++] = origin + pc + i;
+                pc += run;
+                continue;
+            }
+
+            std::size_t length = nextLength();
+            if (!length) break;
+            out[count++] = origin + pc;
+            pc += length;
+        }
+        return count;
+    }
+
+    // Same walk as boundaries(), writing record lengths instead.
+    std::size_t lengths(u8* out, std::size_t capacity) {
+        std::size_t count = 0;
+        while (count < capacity && pc < limit) {
+            if (isOneByteOpcode(code[pc])) {
+                std::size_t run = runs.oneByteRun(pc, std::min(capacity - count, limit - pc));
+                std::fill_n(out + count, run, 1);
+                count += run;
+                pc += run;
+                continue;
+            }
+
+            std::size_t length = nextLength();
+            if (!length) break;
+            out[count++] = static_cast<u8>(length);
+            pc += length;
+        }
+        return count;
+    }
+
+    bool done() const { return pc >= limit || is_truncated; }
+
+    bool truncated() const { return is_truncated; }
+
+    std::size_t position() const { return pc; }
+
+private:
+    std::span<const u8> code;
+    std::size_t origin;
+    std::size_t limit;
+    std::size_t pc = 0;
+    bool is_truncated = false;
+    OpcodeRuns runs;
+
+    // Branch-free while a whole instruction is known to fit; prefixes and the
+    // last few bytes go through instructionLength().
+    std::size_t nextLength() {
+        if (pc + kMaxInstructionLength <= code.size()) {
+            u8 opcode = code[pc];
+            u8 rule = kLengthRules[opcode];
+            if (!(rule & LengthRule::PrefixGroup)) {
+                u8 modrm = code[pc + 1];
+                std::size_t has_modrm = (rule >> 3) & 1;
+                std::size_t test_imm = ((rule >> 4) & 1) & (((modrm >> 3) & 7) == 0);
+                return 1 + (rule & LengthRule::ExtraBytes)
+                    + has_modrm * (1 + kDisplacementLengths[modrm])
+                    + test_imm * (1 + (opcode & 1));
+            }
+        }
+
+        std::size_t length = instructionLength(code, pc);
+        if (!length) is_truncated = true;
+        return length;
+    }
+};
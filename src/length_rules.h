@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+
+#include "instruction.h"
+
+// Per-opcode length rules: how many bytes follow the opcode and ModRM/displacement.
+namespace LengthRule {
+    constexpr u8 ExtraBytes = 7;          // immediate, offset or address bytes
+    constexpr u8 HasModRM = 1 << 3;
+    constexpr u8 TestImmediate = 1 << 4;  // F6/F7: an operand-sized immediate for /0 only
+    constexpr u8 PrefixGroup = 3 << 5;    // lock = 1, rep = 2, segment = 3
+}
+
+constexpr std::array<u8, 256> makeLengthRules() {
+    std::array<u8, 256> t{};
+    auto set = [&t](int first, int last, u8 rule) {
+        for (int i = first; i <= last; i++) t[i] = rule;
+    };
+
+    for (int base = 0x00; base <= 0x38; base += 8) {
+        set(base, base + 3, LengthRule::HasModRM);
+        set(base + 4, base + 4, 1);
+        set(base + 5, base + 5, 2);
+    }
+
+    set(0x26, 0x26, 3 << 5);
+    set(0x2E, 0x2E, 3 << 5);
+    set(0x36, 0x36, 3 << 5);
+    set(0x3E, 0x3E, 3 << 5);
+    set(0x27, 0x27, 0);
+    set(0x2F, 0x2F, 0);
+    set(0x37, 0x37, 0);
+    set(0x3F, 0x3F, 0);
+    set(0x70, 0x7F, 1);
+    set(0x80, 0x80, LengthRule::HasModRM | 1);
+    set(0x81, 0x81, LengthRule::HasModRM | 2);
+    set(0x82, 0x83, LengthRule::HasModRM | 1);
+    set(0x84, 0x8F, LengthRule::HasModRM);
+    set(0x9A, 0x9A, 4);
+    set(0xA0, 0xA3, 2);
+    set(0xA8, 0xA8, 1);
+    set(0xA9, 0xA9, 2);
+    set(0xB0, 0xB7, 1);
+    set(0xB8, 0xBF, 2);
+    set(0xC2, 0xC2, 2);
+    set(0xC4, 0xC5, LengthRule::HasModRM);
+    set(0xC6, 0xC6, LengthRule::HasModRM | 1);
+    set(0xC7, 0xC7, LengthRule::HasModRM | 2);
+    set(0xCA, 0xCA, 2);
+    set(0xCD, 0xCD, 1);
+    set(0xD0, 0xD3, LengthRule::HasModRM);
+    set(0xD4, 0xD5, 1);
+    set(0xD8, 0xDF, LengthRule::HasModRM);
+    set(0xE0, 0xE7, 1);
+    set(0xE8, 0xE9, 2);
+    set(0xEA, 0xEA, 4);
+    set(0xEB, 0xEB, 1);
+    set(0xF0, 0xF0, 1 << 5);
+    set(0xF2, 0xF3, 2 << 5);
+    set(0xF6, 0xF7, LengthRule::HasModRM | LengthRule::TestImmediate);
+    set(0xFE, 0xFF, LengthRule::HasModRM);
+
+    return t;
+}
+
+// Displacement bytes that follow each ModRM byte.
+constexpr std::array<u8, 256> makeDisplacementLengths() {
+    std::array<u8, 256> t{};
+    for (int modrm = 0; modrm < 256; modrm++) {
+        u8 mod = (modrm >> 6) & 3;
+        u8 rm = modrm & 7;
+        t[modrm] = (mod == 1) ? 1 : (mod == 2 || (mod == 0 && rm == 6)) ? 2 : 0;
+    }
+    return t;
+}
+
+inline constexpr std::array<u8, 256> kLengthRules = makeLengthRules();
+inline constexpr std::array<u8, 256> kDisplacementLengths = makeDisplacementLengths();
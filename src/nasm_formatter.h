@@ -0,0 +1,223 @@
+#pragma once
+
+#include <bit>
+#include <string_view>
+
+#include "instruction.h"
+#include "label_index.h"
+#include "instrumentation.h"
+#include "output_buffer.h"
+#include "timing.h"
+
+// Renders decoded instructions as NASM source that reassembles to the original bytes.
+class NasmFormatter {
+public:
+    // Longest line format() can produce, e.g. a prefixed warning or
+    // "lock rep es xchg word es:[bx + si - 32768], ax".
+    static constexpr std::size_t kMaxLineLength = 128;
+
+    // With `labels`, targets in the index get a `label_XXXX:` line and
+    // branches to them name the label instead of the offset. With `timing`,
+    // every line ends in a comment with its clocks and the running total.
+    NasmFormatter(OutputBuffer& out, const LabelIndex* labels = nullptr, const TimingModel* timing = nullptr)
+        : out(out), labels(labels), timing(timing) {}
+
+    u64 totalClocks() const { return clocks; }
+
+    // Code loaded anywhere but offset 0 (a .COM program at 0x100) also gets an
+    // `org`, so absolute branch targets reassemble to the same displacements.
+    void header(std::size_t origin = 0) {
+        out.reserve(kMaxLineLength);
+        out.put("bits 16\n");
+        if (origin) {
+            out.put("org 0x");
+            out.putInt(origin, 16);
+            out.put('\n');
+        }
+        out.put('\n');
+    }
+
+    void format(const DecodedInstruction& instr) {
+        INSTRUMENT_ONLY(Instrumentation::Sample sample(Instrumentation::local().format));
+        out.reserve(2 * kMaxLineLength);
+
+        // A prefix-only record leaves its line open; NASM takes a prefix on a line by itself.
+        if (labels && labels->contains(instr.offset)) {
+            if (line_open) out.put('\n');
+            putLabel(instr.offset);
+            out.put(":\n");
+        }
+        line_open = instr.flags & InstructionFlags::PrefixOnly;
+
+        if (instr.prefixes & Prefix::Lock) out.put("lock ");
+        if (instr.prefixes & Prefix::Repne) out.put("repne ");
+        if (instr.prefixes & Prefix::Rep) out.put("rep ");
+
+        // A segment override is written inside the memory operand when there is one.
+        if ((instr.prefixes & Prefix::Segment) && !hasMemoryOperand(instr)) {
+            out.put(getRegisterName(instr.segment));
+            out.put(' ');
+        }
+
+        if (instr.flags & InstructionFlags::PrefixOnly) {
+            if (timing) clocks += 2 * std::popcount(instr.prefixes);
+            return;
+        }
+
+        if (instr.operation == Operation::Unknown) {
+            out.put("[WARNING] Unknown opcode 0x");
+            if (instr.opcode < 0x10) out.put('0');
+            out.putInt(instr.opcode, 16);
+            out.put(" at position ");
+            out.putInt(instr.offset + instr.length - 1);
+            out.put('\n');
+            return;
+        }
+
+        out.put(getMnemonic(instr.operation));
+        if (isStringOp(instr.operation)) {
+            out.put((instr.flags & InstructionFlags::Wide) ? 'w' : 'b');
+        }
+
+        for (int i = 0; i < 2 && instr.operands[i].kind != OperandKind::None; i++) {
+            out.put((i == 0) ? " " : ", ");
+            putOperand(instr, instr.operands[i]);
+        }
+
+        if (timing) putClocks(timing->estimate(instr));
+        out.put('\n');
+    }
+
+private:
+    OutputBuffer& out;
+    const LabelIndex* labels;
+    const TimingModel* timing;
+    bool line_open = false;
+    u64 clocks = 0;
+
+    // " ; clocks: +17 = 120 (8 + 5ea + 4p, 4 not taken)"
+    void putClocks(const InstructionClocks& estimate) {
+        clocks += estimate.total();
+
+        out.put(" ; clocks: +");
+        out.putInt(estimate.total());
+        out.put(" = ");
+        out.putInt(clocks);
+
+        if (!estimate.ea && !estimate.penalty && !estimate.not_taken) return;
+
+        out.put(" (");
+        out.putInt(estimate.base);
+        if (estimate.ea) {
+            out.put(" + ");
+            out.putInt(estimate.ea);
+            out.put("ea");
+        }
+        if (estimate.penalty) {
+            out.put(" + ");
+            out.putInt(estimate.penalty);
+            out.put('p');
+        }
+        if (estimate.not_taken) {
+            out.put(", ");
+            out.putInt(estimate.not_taken);
+            out.put(" not taken");
+        }
+        out.put(')');
+    }
+
+    void putLabel(std::size_t offset) {
+        out.put("label_");
+        for (std::size_t digits = 4; digits > 1 && (offset >> (4 * (digits - 1))) == 0; digits--) out.put('0');
+        out.putInt(offset, 16);
+    }
+
+    static bool hasMemoryOperand(const DecodedInstruction& instr) {
+        return instr.operands[0].kind == OperandKind::Memory || instr.operands[1].kind == OperandKind::Memory;
+    }
+
+    void putSize(const DecodedInstruction& instr) {
+        out.put((instr.flags & InstructionFlags::Wide) ? "word " : "byte ");
+    }
+
+    void putOperand(const DecodedInstruction& instr, Operand operand) {
+        INSTRUMENT_ONLY(Instrumentation::local().operands[static_cast<u8>(operand.kind)]++);
+        switch (operand.kind) {
+            case OperandKind::Register:
+                out.put(getRegisterName(static_cast<Register>(operand.value)));
+                break;
+            case OperandKind::Memory:
+                putMemory(instr, static_cast<EffectiveAddress>(operand.value));
+                break;
+            case OperandKind::Immediate:
+                if (instr.flags & InstructionFlags::SizedImmediate) putSize(instr);
+                out.putInt(getImmediateValue(instr, operand));
+                break;
+            case OperandKind::SignedImmediate:
+                out.putInt(getImmediateValue(instr, operand));
+                break;
+            case OperandKind::Relative:
+                putRelative(instr, operand.value);
+                break;
+            case OperandKind::Far:
+                out.putInt(instr.immediate);
+                out.put(':');
+                out.putInt(static_cast<u16>(instr.displacement));
+                break;
+            case OperandKind::None:
+                break;
+        }
+    }
+
+    void putMemory(const DecodedInstruction& instr, EffectiveAddress ea) {
+        static constexpr std::string_view addr[] = {"bx + si", "bx + di", "bp + si", "bp + di", "si", "di", "bp", "bx"};
+
+        if (instr.flags & InstructionFlags::SizedMemory) putSize(instr);
+        if (instr.prefixes & Prefix::Segment) {
+            out.put(getRegisterName(instr.segment));
+            out.put(':');
+        }
+
+        out.put('[');
+        if (ea == EffectiveAddress::Direct) {
+            out.putInt(static_cast<u16>(instr.displacement));
+        } else {
+            out.put(addr[static_cast<u8>(ea)]);
+            putDisplacement(instr.displacement);
+        }
+        out.put(']');
+    }
+
+    void putDisplacement(int disp) {
+        if (disp > 0) {
+            out.put(" + ");
+            out.putInt(disp);
+        } else if (disp < 0) {
+            out.put(" - ");
+            out.putInt(-disp);
+        }
+    }
+
+    // Short jumps are written relative to $, which does not depend on the
+    // origin; near ones as the absolute target, which counts from the `org` line.
+    void putRelative(const DecodedInstruction& instr, u8 size) {
+        std::size_t target = getBranchTarget(instr);
+        if (labels && labels->contains(target)) {
+            // Keep jmp the same size; NASM would otherwise pick short or near by distance.
+            if (instr.operation == Operation::Jmp) out.put((size == 1) ? "short " : "near ");
+            putLabel(target);
+            return;
+        }
+
+        if (size == 1) {
+            // $ is the first byte of the instruction, so a lock or rep prefix counts towards the distance.
+            int disp = instr.displacement;
+            int len = instr.length;
+            out.put((disp >= 0) ? "$+ " : "$- ");
+            out.putInt((disp >= 0) ? disp + len : -(disp + len));
+            return;
+        }
+
+        out.putInt(static_cast<i16>(instr.displacement + instr.offset + instr.length));
+    }
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <span>
+
+#include "instruction.h"
+#include "length_rules.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIM8086_X86_SIMD 1
+#endif
+
+// Vectorized pre-pass over opcode bytes. For every byte it sets a bit in
+// `one_byte` if that byte alone is a whole instruction (push/pop/inc/dec reg,
+// nullary ops, unknown opcodes), so runs of them can be handled in bulk
+// instead of one table dispatch per byte.
+
+constexpr bool isOneByteOpcode(u8 opcode) {
+    return kLengthRules[opcode] == 0;
+}
+
+constexpr bool isPrefixOpcode(u8 opcode) {
+    return kLengthRules[opcode] & LengthRule::PrefixGroup;
+}
+
+// pshufb set membership: rows[lo] has bit (hi & 7) set when (hi << 4 | lo) is in
+// the set, split into high nibbles 0-7 and 8-15.
+struct NibbleTable {
+    std::array<u8, 16> low_rows;
+    std::array<u8, 16> high_rows;
+};
+
+constexpr NibbleTable makeNibbleTable(bool (*member)(u8)) {
+    NibbleTable t{};
+    for (int hi = 0; hi < 16; hi++) {
+        for (int lo = 0; lo < 16; lo++) {
+            if (!member(static_cast<u8>(hi << 4 | lo))) continue;
+            if (hi < 8) {
+                t.low_rows[lo] |= 1 << hi;
+            } else {
+                t.high_rows[lo] |= 1 << (hi - 8);
+            }
+        }
+    }
+    return t;
+}
+
+inline constexpr NibbleTable kOneByteNibbles = makeNibbleTable(isOneByteOpcode);
+
+// All classifiers write ceil(count / 64) words to the output.
+inline void classifyOpcodesScalar(const u8* bytes, std::size_t count, u64* one_byte) {
+    for (std::size_t word = 0; word * 64 < count; word++) {
+        u64 one = 0;
+        std::size_t n = std::min<std::size_t>(64, count - word * 64);
+        for (std::size_t i = 0; i < n; i++) {
+            one |= u64(isOneByteOpcode(bytes[word * 64 + i])) << i;
+        }
+        one_byte[word] = one;
+    }
+}
+
+#ifdef SIM8086_X86_SIMD
+
+__attribute__((target("sse4.2")))
+inline u64 classifySse42Word(const u8* bytes) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i one_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kOneByteNibbles.low_rows.data()));
+    const __m128i one_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kOneByteNibbles.high_rows.data()));
+
+    u64 one = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i * 16));
+        __m128i lo = _mm_and_si128(x, nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), nibble);
+        __m128i upper = _mm_cmpgt_epi8(hi, _mm_set1_epi8(7));
+        __m128i bit = _mm_shuffle_epi8(bits, hi);
+
+        __m128i one_row = _mm_blendv_epi8(_mm_shuffle_epi8(one_lo, lo), _mm_shuffle_epi8(one_hi, lo), upper);
+
+        one |= u64(u16(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(one_row, bit), bit)))) << (i * 16);
+    }
+
+    return one;
+}
+
+__attribute__((target("avx2")))
+inline u64 classifyAvx2Word(const u8* bytes) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                          1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m256i one_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(kOneByteNibbles.low_rows.data())));
+    const __m256i one_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(kOneByteNibbles.high_rows.data())));
+
+    u64 one = 0;
+    for (int i = 0; i < 2; i++) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + i * 32));
+        __m256i lo = _mm256_and_si256(x, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+        __m256i upper = _mm256_cmpgt_epi8(hi, _mm256_set1_epi8(7));
+        __m256i bit = _mm256_shuffle_epi8(bits, hi);
+
+        __m256i one_row = _mm256_blendv_epi8(_mm256_shuffle_epi8(one_lo, lo), _mm256_shuffle_epi8(one_hi, lo), upper);
+
+        one |= u64(u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(one_row, bit), bit)))) << (i * 32);
+    }
+
+    return one;
+}
+
+template<u64 (*ClassifyWord)(const u8*)>
+inline void classifyOpcodesSimd(const u8* bytes, std::size_t count, u64* one_byte) {
+    std::size_t word = 0;
+    for (; (word + 1) * 64 <= count; word++) {
+        one_byte[word] = ClassifyWord(bytes + word * 64);
+    }
+    if (word * 64 < count) {
+        classifyOpcodesScalar(bytes + word * 64, count - word * 64, one_byte + word);
+    }
+}
+
+inline void classifyOpcodesSse42(const u8* bytes, std::size_t count, u64* one_byte) {
+    classifyOpcodesSimd<classifySse42Word>(bytes, count, one_byte);
+}
+
+inline void classifyOpcodesAvx2(const u8* bytes, std::size_t count, u64* one_byte) {
+    classifyOpcodesSimd<classifyAvx2Word>(bytes, count, one_byte);
+}
+
+#endif
+
+using ClassifyOpcodesFn = void(*)(const u8*, std::size_t, u64*);
+
+// Picks the widest implementation the CPU supports, once.
+inline ClassifyOpcodesFn selectOpcodeClassifier() {
+#ifdef SIM8086_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return classifyOpcodesAvx2;
+    if (__builtin_cpu_supports("sse4.2")) return classifyOpcodesSse42;
+#endif
+    return classifyOpcodesScalar;
+}
+
+inline void classifyOpcodes(const u8* bytes, std::size_t count, u64* one_byte) {
+    static const ClassifyOpcodesFn classify = selectOpcodeClassifier();
+    classify(bytes, count, one_byte);
+}
+
+// Classifies a decode window one block at a time as the caller walks it.
+class OpcodeRuns {
+public:
+    static constexpr std::size_t kBlockSize = 512;
+
+    OpcodeRuns(std::span<const u8> code) : code(code) {}
+
+    // Number of consecutive one-byte instructions starting at `pos`, at most
+    // `max_run`. A run that reaches the end of the block stops there.
+    std::size_t oneByteRun(std::size_t pos, std::size_t max_run) {
+        if (pos < base || pos >= base + kBlockSize) classify(pos);
+
+        std::size_t index = pos - base;
+        std::size_t run = std::countr_one(one_byte[index / 64] >> (index % 64));
+        if (run == 64 - index % 64) {
+            for (std::size_t word = index / 64 + 1; word < one_byte.size(); word++) {
+                std::size_t ones = std::countr_one(one_byte[word]);
+                run += ones;
+                if (ones < 64) break;
+            }
+        }
+
+        return std::min(run, max_run);
+    }
+
+private:
+    std::span<const u8> code;
+    std::size_t base = SIZE_MAX / 2;
+    std::array<u64, kBlockSize / 64> one_byte;
+
+    // Words past the end of `code` stay zero, so runs never leave it.
+    void classify(std::size_t pos) {
+        base = pos & ~std::size_t(63);
+        one_byte.fill(0);
+        classifyOpcodes(code.data() + base, std::min(kBlockSize, code.size() - base), one_byte.data());
+    }
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <array>
+
+#include "instruction.h"
+
+// Which InstructionDecoder handler decodes an opcode.
+enum class Handler : u8 {
+    Unknown,
+    XchgRegMem,
+    RegMem,
+    Rets,
+    Loads,
+    RegSegReg,
+    MovAccMem,
+    XchgAccMem,
+    AccMem,
+    StrOps,
+    IncDec,
+    SegRegPushPop,
+    PushPop,
+    ConJmp,
+    ImmRegMem,
+    InOut,
+    ControlTransfer,
+    Grp3,
+    Grp5,
+    RegMem16,
+    ImmToReg,
+    ImmToMem,
+    Int,
+    ShtRot,
+    ESC,
+    Loop,
+    NullaryInstructionTwoBytes,
+    NullaryInstruction,
+};
+
+struct OpcodeEntry {
+    Handler handler;
+    Operation operation;
+};
+
+// Operations selected within an opcode group, by the ModRM reg field or, for
+// the last three, by the opcode's position in its range. None marks
+// encodings that name no instruction.
+constexpr Operation kImmRegMemOperations[] = {Operation::Add, Operation::Or, Operation::Adc, Operation::Sbb,
+                                              Operation::And, Operation::Sub, Operation::Xor, Operation::Cmp};
+constexpr Operation kGrp3Operations[] = {Operation::Test, Operation::None, Operation::Not, Operation::Neg,
+                                         Operation::Mul, Operation::Imul, Operation::Div, Operation::Idiv};
+constexpr Operation kGrp5Operations[] = {Operation::Inc, Operation::Dec, Operation::Call, Operation::CallFar,
+                                         Operation::Jmp, Operation::JmpFar, Operation::Push, Operation::None};
+constexpr Operation kShtRotOperations[] = {Operation::Rol, Operation::Ror, Operation::Rcl, Operation::Rcr,
+                                           Operation::Sal, Operation::Shr, Operation::None, Operation::Sar};
+constexpr Operation kStrOpsOperations[] = {Operation::Movs, Operation::Cmps, Operation::None,
+                                           Operation::Stos, Operation::Lods, Operation::Scas}; // (opcode - 0xA4) / 2
+constexpr Operation kIntOperations[] = {Operation::Int3, Operation::Int, Operation::Into, Operation::Iret}; // opcode - 0xCC
+constexpr Operation kLoopOperations[] = {Operation::Loopne, Operation::Loope, Operation::Loop, Operation::Jcxz}; // opcode - 0xE0
+
+// Prefix bytes (0x26, 0x2E, 0x36, 0x3E, 0xF0, 0xF2, 0xF3) never reach the
+// table; InstructionDecoder consumes them before dispatch.
+constexpr std::array<OpcodeEntry, 256> makeOpcodeTable() {
+    std::array<OpcodeEntry, 256> t{};
+    t.fill({Handler::Unknown, Operation::Unknown});
+
+    for (int i = 0x00; i <= 0x03; i++) {
+        t[i] = {Handler::RegMem, Operation::Add};
+    }
+
+    for (int i = 0x04; i <= 0x05; i++) {
+        t[i] = {Handler::AccMem, Operation::Add};
+    }
+
+    for (int i = 0x06; i <= 0x07; i++) {
+        t[i] = {Handler::SegRegPushPop, Operation::None};
+    }
+
+    for (int i = 0x08; i <= 0x0B; i++) {
+        t[i] = {Handler::RegMem, Operation::Or};
+    }
+
+    for (int i = 0x0C; i <= 0x0D; i++) {
+        t[i] = {Handler::AccMem, Operation::Or};
+    }
+
+    for (int i = 0x0E; i <= 0x0F; i++) {
+        t[i] = {Handler::SegRegPushPop, Operation::None};
+    }
+
+    for (int i = 0x10; i <= 0x13; i++) {
+        t[i] = {Handler::RegMem, Operation::Adc};
+    }
+
+    for (int i = 0x14; i <= 0x15; i++) {
+        t[i] = {Handler::AccMem, Operation::Adc};
+    }
+
+    for (int i = 0x16; i <= 0x17; i++) {
+        t[i] = {Handler::SegRegPushPop, Operation::None};
+    }
+
+    for (int i = 0x18; i <= 0x1B; i++) {
+        t[i] = {Handler::RegMem, Operation::Sbb};
+    }
+
+    for (int i = 0x1C; i <= 0x1D; i++) {
+        t[i] = {Handler::AccMem, Operation::Sbb};
+    }
+
+    for (int i = 0x1E; i <= 0x1F; i++) {
+        t[i] = {Handler::SegRegPushPop, Operation::None};
+    }
+
+    for (int i = 0x20; i <= 0x23; i++) {
+        t[i] = {Handler::RegMem, Operation::And};
+    }
+
+    for (int i = 0x24; i <= 0x25; i++) {
+        t[i] = {Handler::AccMem, Operation::And};
+    }
+
+    for (int i = 0x28; i <= 0x2B; i++) {
+        t[i] = {Handler::RegMem, Operation::Sub};
+    }
+
+    for (int i = 0x2C; i <= 0x2D; i++) {
+        t[i] = {Handler::AccMem, Operation::Sub};
+    }
+
+    for (int i = 0x30; i <= 0x33; i++) {
+        t[i] = {Handler::RegMem, Operation::Xor};
+    }
+
+    for (int i = 0x34; i <= 0x35; i++) {
+        t[i] = {Handler::AccMem, Operation::Xor};
+    }
+
+    for (int i = 0x38; i <= 0x3B; i++) {
+        t[i] = {Handler::RegMem, Operation::Cmp};
+    }
+
+    for (int i = 0x3C; i <= 0x3D; i++) {
+        t[i] = {Handler::AccMem, Operation::Cmp};
+    }
+
+    for (int i = 0x40; i <= 0x4F; i++) {
+        t[i] = {Handler::IncDec, Operation::None};
+    }
+
+    for (int i = 0x50; i <= 0x5F; i++) {
+        t[i] = {Handler::PushPop, Operation::None};
+    }
+
+    for (int i = 0x70; i <= 0x7F; i++) {
+        t[i] = {Handler::ConJmp, Operation::None};
+    }
+
+    for (int i = 0x80; i <= 0x83; i++) {
+        t[i] = {Handler::ImmRegMem, Operation::None};
+    }
+
+    for (int i = 0x84; i <= 0x85; i++) {
+        t[i] = {Handler::RegMem, Operation::Test};
+    }
+
+    for (int i = 0x86; i <= 0x87; i++) {
+        t[i] = {Handler::XchgRegMem, Operation::Xchg};
+    }
+
+    for (int i = 0x88; i <= 0x8B; i++) {
+        t[i] = {Handler::RegMem, Operation::Mov};
+    }
+
+    for (int i = 0x90; i <= 0x97; i++) {
+        t[i] = {Handler::XchgAccMem, Operation::Xchg};
+    }
+
+    for (int i = 0xA0; i <= 0xA3; i++) {
+        t[i] = {Handler::MovAccMem, Operation::Mov};
+    }
+
+    for (int i = 0xA4; i <= 0xA7; i++) {
+        t[i] = {Handler::StrOps, Operation::None};
+    }
+
+    for (int i = 0xA8; i <= 0xA9; i++) {
+        t[i] = {Handler::AccMem, Operation::Test};
+    }
+
+    for (int i = 0xAA; i <= 0xAF; i++) {
+        t[i] = {Handler::StrOps, Operation::None};
+    }
+
+    for (int i = 0xB0; i <= 0xBF; i++) {
+        t[i] = {Handler::ImmToReg, Operation::Mov};
+    }
+
+    for (int i = 0xC6; i <= 0xC7; i++) {
+        t[i] = {Handler::ImmToMem, Operation::Mov};
+    }
+
+    for (int i = 0xCC; i <= 0xCF; i++) {
+        t[i] = {Handler::Int, Operation::None};
+    }
+
+    for (int i = 0xD0; i <= 0xD3; i++) {
+        t[i] = {Handler::ShtRot, Operation::None};
+    }
+
+    for (int i = 0xD8; i <= 0xDF; i++) {
+        t[i] = {Handler::ESC, Operation::Esc};
+    }
+
+    for (int i = 0xE0; i <= 0xE3; i++) {
+        t[i] = {Handler::Loop, Operation::None};
+    }
+
+    for (int i = 0xE4; i <= 0xE7; i++) {
+        t[i] = {Handler::InOut, Operation::None};
+    }
+
+    for (int i = 0xEC; i <= 0xEF; i++) {
+        t[i] = {Handler::InOut, Operation::None};
+    }
+
+    for (int i = 0xF6; i <= 0xF7; i++) {
+        t[i] = {Handler::Grp3, Operation::None};
+    }
+
+    t[0x27] = {Handler::NullaryInstruction, Operation::Daa};
+    t[0x2F] = {Handler::NullaryInstruction, Operation::Das};
+    t[0x37] = {Handler::NullaryInstruction, Operation::Aaa};
+    t[0x3F] = {Handler::NullaryInstruction, Operation::Aas};
+    t[0x8C] = {Handler::RegSegReg, Operation::Mov};
+    t[0x8D] = {Handler::Loads, Operation::Lea};
+    t[0x8E] = {Handler::RegSegReg, Operation::Mov};
+    t[0x8F] = {Handler::RegMem16, Operation::Pop};
+    t[0x98] = {Handler::NullaryInstruction, Operation::Cbw};
+    t[0x99] = {Handler::NullaryInstruction, Operation::Cwd};
+    t[0x9A] = {Handler::ControlTransfer, Operation::Call};
+    t[0x9B] = {Handler::NullaryInstruction, Operation::Wait};
+    t[0x9C] = {Handler::NullaryInstruction, Operation::Pushf};
+    t[0x9D] = {Handler::NullaryInstruction, Operation::Popf};
+    t[0x9E] = {Handler::NullaryInstruction, Operation::Sahf};
+    t[0x9F] = {Handler::NullaryInstruction, Operation::Lahf};
+    t[0xD4] = {Handler::NullaryInstructionTwoBytes, Operation::Aam};
+    t[0xD5] = {Handler::NullaryInstructionTwoBytes, Operation::Aad};
+    t[0xD7] = {Handler::NullaryInstruction, Operation::Xlat};
+    t[0xC2] = {Handler::Rets, Operation::Ret};
+    t[0xC3] = {Handler::Rets, Operation::Ret};
+    t[0xC4] = {Handler::Loads, Operation::Les};
+    t[0xC5] = {Handler::Loads, Operation::Lds};
+    t[0xCA] = {Handler::Rets, Operation::Retf};
+    t[0xCB] = {Handler::Rets, Operation::Retf};
+    t[0xE8] = {Handler::ControlTransfer, Operation::Call};
+    t[0xE9] = {Handler::ControlTransfer, Operation::Jmp};
+    t[0xEA] = {Handler::ControlTransfer, Operation::Jmp};
+    t[0xEB] = {Handler::ControlTransfer, Operation::Jmp};
+    t[0xF4] = {Handler::NullaryInstruction, Operation::Hlt};
+    t[0xF5] = {Handler::NullaryInstruction, Operation::Cmc};
+    t[0xF8] = {Handler::NullaryInstruction, Operation::Clc};
+    t[0xF9] = {Handler::NullaryInstruction, Operation::Stc};
+    t[0xFA] = {Handler::NullaryInstruction, Operation::Cli};
+    t[0xFB] = {Handler::NullaryInstruction, Operation::Sti};
+    t[0xFC] = {Handler::NullaryInstruction, Operation::Cld};
+    t[0xFD] = {Handler::NullaryInstruction, Operation::Std};
+    t[0xFE] = {Handler::Grp5, Operation::None};
+    t[0xFF] = {Handler::Grp5, Operation::None};
+
+    return t;
+}
+
+inline constexpr std::array<OpcodeEntry, 256> kOpcodeTable = makeOpcodeTable();
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <string_view>
+#include <vector>
+#include <cerrno>
+#include <unistd.h>
+
+// Large reusable byte buffer flushed to a file descriptor with few big writes.
+// Callers reserve() room for a whole line, then append without further checks.
+// A buffer without a descriptor only grows, for text that is spliced before output.
+class OutputBuffer {
+public:
+    OutputBuffer(int fd, std::size_t capacity = 1 << 20) : fd(fd), buffer(capacity) {
+        pos = buffer.data();
+        end = buffer.data() + buffer.size();
+    }
+
+    OutputBuffer() : OutputBuffer(-1) {}
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    ~OutputBuffer() { flush(); }
+
+    void reserve(std::size_t bytes) {
+        if (static_cast<std::size_t>(end - pos) >= bytes) return;
+
+        if (fd >= 0) flush();
+        if (static_cast<std::size_t>(end - pos) < bytes) grow(bytes);
+    }
+
+    void put(char c) { *pos++ = c; }
+
+    void put(std::string_view text) {
+        pos = std::copy(text.begin(), text.end(), pos);
+    }
+
+    template<typename T>
+    void putInt(T value, int base = 10) {
+        pos = std::to_chars(pos, end, value, base).ptr;
+    }
+
+    // Blocks larger than the buffer go straight to the descriptor.
+    void append(std::string_view text) {
+        if (fd >= 0 && text.size() >= buffer.size()) {
+            flush();
+            write(text.data(), text.size());
+            return;
+        }
+        reserve(text.size());
+        put(text);
+    }
+
+    std::size_t size() const { return pos - buffer.data(); }
+
+    std::string_view view(std::size_t from = 0) const {
+        return {buffer.data() + from, size() - from};
+    }
+
+    void clear() { pos = buffer.data(); }
+
+    // Moves the buffered bytes out into `storage` and carries on writing into
+    // the memory `storage` held before, so full blocks change hands uncopied.
+    void exchange(std::vector<char>& storage) {
+        std::size_t used = size();
+        storage.resize(buffer.size());
+        buffer.swap(storage);
+        storage.resize(used);
+        pos = buffer.data();
+        end = buffer.data() + buffer.size();
+    }
+
+    // Writes out everything buffered so far; returns false if the descriptor
+    // rejected this or any earlier write.
+    bool flush() {
+        if (fd < 0) return true;
+
+        write(buffer.data(), pos - buffer.data());
+        pos = buffer.data();
+        return !failed;
+    }
+
+private:
+    int fd;
+    std::vector<char> buffer;
+    char* pos;
+    char* end;
+    bool failed = false;
+
+    void write(const char* data, std::size_t size) {
+        while (size > 0 && !failed) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                failed = true;
+                return;
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+    void grow(std::size_t bytes) {
+        std::size_t used = size();
+        buffer.resize(std::max(buffer.size() * 2, used + bytes));
+        pos = buffer.data() + used;
+        end = buffer.data() + buffer.size();
+    }
+};
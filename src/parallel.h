@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <exception>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "decoder.h"
+#include "instruction.h"
+#include "length_decoder.h"
+#include "nasm_formatter.h"
+#include "output_buffer.h"
+
+// Decodes a mapped image on several threads, with output identical to a
+// single-threaded run. Every round splits the next part of the image into one
+// chunk per thread. Only the first chunk of a round starts on a known
+// instruction boundary, so each other worker also walks instruction lengths
+// from every offset where the previous chunk's last instruction could end,
+// until that stream converges with its own. Stitching then picks the candidate
+// that starts at the previous chunk's real end, decodes the few instructions
+// before it converges and splices in the formatted chunk from there.
+class ParallelDisassembler {
+public:
+    ParallelDisassembler(unsigned threads, std::size_t chunk_size = 1 << 20)
+        : chunks(std::max(threads, 1u)), chunk_size(std::max(chunk_size, kMaxInstructionLength)) {}
+
+    void run(std::span<const u8> code, OutputBuffer& output) {
+        std::size_t next = 0;
+
+        while (next < code.size()) {
+            std::size_t count = 0;
+            std::size_t begin = next;
+            while (count < chunks.size() && begin < code.size()) {
+                std::size_t end = std::min(begin + chunk_size, code.size());
+                if (code.size() - end < kMaxInstructionLength) end = code.size();
+
+                chunks[count].begin = begin;
+                chunks[count].end = end;
+                chunks[count].speculative = count > 0;
+                begin = end;
+                count++;
+            }
+
+            std::vector<std::thread> workers;
+            for (std::size_t i = 1; i < count; i++) {
+                workers.emplace_back([this, code, i]() { decodeChunk(code, chunks[i]); });
+            }
+            decodeChunk(code, chunks[0]);
+            for (auto& worker : workers) worker.join();
+
+            for (std::size_t i = 0; i < count; i++) {
+                next = stitch(code, chunks[i], next, output);
+            }
+        }
+    }
+
+private:
+    struct Candidate {
+        bool converged;
+        std::size_t resume; // first boundary shared with the chunk's own stream
+    };
+
+    struct Chunk {
+        std::size_t begin;
+        std::size_t end;
+        bool speculative;
+
+        // Instructions decoded from `begin` that start before `end`, already formatted.
+        std::vector<std::size_t> starts;
+        std::vector<std::size_t> lines;
+        OutputBuffer text;
+        std::size_t next;
+        std::exception_ptr error;
+
+        // candidates[d] decodes from begin + d; candidates[0] is the chunk itself.
+        std::array<Candidate, kMaxInstructionLength> candidates;
+    };
+
+    std::vector<Chunk> chunks;
+    std::size_t chunk_size;
+
+    // The decode window for a chunk covers every instruction that starts before its end.
+    static std::span<const u8> window(std::span<const u8> code, const Chunk& chunk, std::size_t from) {
+        std::size_t window_end = std::min(chunk.end + kMaxInstructionLength - 1, code.size());
+        return code.subspan(from, window_end - from);
+    }
+
+    static bool isFinal(std::span<const u8> code, const Chunk& chunk) {
+        return chunk.end == code.size();
+    }
+
+    void decodeChunk(std::span<const u8> code, Chunk& chunk) {
+        chunk.starts.clear();
+        chunk.lines.clear();
+        chunk.text.clear();
+        chunk.error = nullptr;
+
+        InstructionDecoder decoder(window(code, chunk, chunk.begin), chunk.begin, isFinal(code, chunk));
+        NasmFormatter formatter(chunk.text);
+        std::array<DecodedInstruction, 1024> batch;
+
+        while (std::size_t count = decoder.decode(batch.data(), batch.size())) {
+            for (std::size_t i = 0; i < count; i++) {
+                chunk.starts.push_back(batch[i].offset);
+                chunk.lines.push_back(chunk.text.size());
+                formatter.format(batch[i]);
+            }
+        }
+        chunk.next = chunk.begin + decoder.position();
+        if (decoder.truncated()) chunk.error = std::make_exception_ptr(truncatedInstruction(decoder.truncation()));
+
+        if (!chunk.speculative) return;
+
+        for (std::size_t d = 1; d < kMaxInstructionLength && chunk.begin + d < chunk.end; d++) {
+            decodeCandidate(code, chunk, chunk.candidates[d], chunk.begin + d);
+        }
+    }
+
+    void decodeCandidate(std::span<const u8> code, const Chunk& chunk, Candidate& candidate, std::size_t start) {
+        LengthDecoder lengths(window(code, chunk, start), start, isFinal(code, chunk));
+        std::array<std::size_t, 16> starts;
+
+        candidate.converged = false;
+        while (std::size_t count = lengths.boundaries(starts.data(), starts.size())) {
+            for (std::size_t i = 0; i < count; i++) {
+                if (std::binary_search(chunk.starts.begin(), chunk.starts.end(), starts[i])) {
+                    candidate.converged = true;
+                    candidate.resume = starts[i];
+                    return;
+                }
+            }
+        }
+    }
+
+    // Writes the chunk's part of the real instruction stream, which starts at
+    // `start`, and returns where the next chunk's part starts.
+    std::size_t stitch(std::span<const u8> code, Chunk& chunk, std::size_t start, OutputBuffer& output) {
+        if (start == chunk.begin) {
+            output.append(chunk.text.view());
+            if (chunk.error) std::rethrow_exception(chunk.error);
+            return chunk.next;
+        }
+
+        const Candidate& candidate = chunk.candidates[start - chunk.begin];
+        std::span<const u8> head = candidate.converged ? code.subspan(start, candidate.resume - start) : window(code, chunk, start);
+        InstructionDecoder decoder(head, start, candidate.converged || isFinal(code, chunk));
+        NasmFormatter formatter(output);
+        std::array<DecodedInstruction, 16> batch;
+
+        while (std::size_t count = decoder.decode(batch.data(), batch.size())) {
+            for (std::size_t i = 0; i < count; i++) {
+                formatter.format(batch[i]);
+            }
+        }
+        if (decoder.truncated()) throw truncatedInstruction(decoder.truncation());
+
+        if (!candidate.converged) return start + decoder.position();
+
+        std::size_t line = std::lower_bound(chunk.starts.begin(), chunk.starts.end(), candidate.resume) - chunk.starts.begin();
+        output.append(chunk.text.view(chunk.lines[line]));
+
+        if (chunk.error) std::rethrow_exception(chunk.error);
+        return chunk.next;
+    }
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "decoder.h"
+#include "input.h"
+#include "instruction.h"
+#include "nasm_formatter.h"
+#include "output_buffer.h"
+#include "spsc_ring.h"
+
+// Disassembles a stream that cannot be split into chunks (stdin, a pipe) in
+// three stages on three threads. A reader thread pulls windows from the
+// descriptor and decodes them straight into a ring of records; the calling
+// thread formats records into text blocks; a writer thread appends full
+// blocks to the output. Both rings are bounded, so a slow stage stalls the
+// ones before it instead of letting memory grow, and blocks are recycled
+// rather than allocated per write. An error ends the stream after every
+// record before it has been written, as with a single-threaded run.
+class PipelinedDisassembler {
+public:
+    PipelinedDisassembler(std::size_t ring_records = 1 << 15, std::size_t block_size = 1 << 18)
+        : records(ring_records), filled(kBlocks), empty(2 * kBlocks), block_size(block_size) {}
+
+    void run(int fd, OutputBuffer& output) {
+        std::thread reader([this, fd]() { decodeStage(fd); });
+        std::thread writer([this, &output]() { writeStage(output); });
+        formatStage();
+        writer.join();
+        reader.join();
+
+        if (error) std::rethrow_exception(error);
+    }
+
+private:
+    static constexpr std::size_t kBlocks = 4;
+    static constexpr std::size_t kBatch = 1024;
+
+    SpscRing<DecodedInstruction> records;
+    SpscRing<std::vector<char>> filled;
+    SpscRing<std::vector<char>> empty;
+    std::size_t block_size;
+    // Set by the reader before it closes `records`; read after it is joined.
+    std::exception_ptr error;
+
+    void decodeStage(int fd) {
+        try {
+            ChunkReader reader(fd);
+            std::size_t consumed = 0;
+            do {
+                std::span<const u8> window = reader.next(consumed);
+                InstructionDecoder decoder(window, reader.origin(), reader.eof());
+
+                for (;;) {
+                    std::span<DecodedInstruction> slots = records.claim(kBatch);
+                    std::size_t count = decoder.decode(slots.data(), slots.size());
+                    if (!count) break;
+                    records.publish(count);
+                }
+
+                if (decoder.truncated()) throw truncatedInstruction(decoder.truncation());
+                consumed = decoder.position();
+            } while (!reader.eof());
+        } catch (const std::runtime_error&) {
+            error = std::current_exception();
+        }
+        records.close();
+    }
+
+    void formatStage() {
+        OutputBuffer text;
+        NasmFormatter formatter(text);
+
+        while (true) {
+            std::span<DecodedInstruction> batch = records.acquire(kBatch);
+            if (batch.empty()) break;
+
+            for (const DecodedInstruction& instr : batch) formatter.format(instr);
+            records.release(batch.size());
+
+            if (text.size() >= block_size) handOff(text);
+        }
+
+        if (text.size()) handOff(text);
+        filled.close();
+    }
+
+    // Passes the formatted text on, continuing in a block the writer is done with.
+    void handOff(OutputBuffer& text) {
+        std::vector<char> block;
+        if (std::span<std::vector<char>> spare = empty.tryAcquire(1); !spare.empty()) {
+            block = std::move(spare[0]);
+            empty.release(1);
+        }
+        text.exchange(block);
+
+        filled.claim(1)[0] = std::move(block);
+        filled.publish(1);
+    }
+
+    void writeStage(OutputBuffer& output) {
+        while (true) {
+            std::span<std::vector<char>> next = filled.acquire(1);
+            if (next.empty()) break;
+
+            std::vector<char> block = std::move(next[0]);
+            filled.release(1);
+            output.append({block.data(), block.size()});
+
+            // A block is only allocated while none is spare, so no more than
+            // kBlocks + 3 exist and the spares always fit without waiting.
+            empty.claim(1)[0] = std::move(block);
+            empty.publish(1);
+        }
+    }
+};
@@ -1,749 +1,627 @@
 #include <iostream>
+#include <array>
+#include <charconv>
 #include <fstream>
-#include <vector>
+#include <limits>
+#include <optional>
+#include <span>
 #include <string>
-#include <format>
-#include <array>
-#include <bitset>
-
-using u8 = uint8_t;
-using u16 = uint16_t;
-
-using i8 = int8_t;
-using i16 = int16_t;
-
-class InstructionDecoder {
-public:
-    InstructionDecoder(const std::string& filename) {
-        code = readBinaryFile(filename);
-    }
-
-    void decode() {
-        std:: cout << "bits 16\n\n";
-        while (pc < code.size()) {
-            u8 opcode = code[pc];
-            auto& table = getOpcodeTable();
-            auto handler = table[opcode];
-            (this->*handler.handler)(opcode, handler.mnemonic);
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "batch.h"
+#include "binary_format.h"
+#include "checkpoint_index.h"
+#include "control_flow.h"
+#include "cpu.h"
+#include "decode_cache.h"
+#include "decoder.h"
+#include "executable.h"
+#include "idiom_search.h"
+#include "incremental.h"
+#include "input.h"
+#include "instruction_stream.h"
+#include "label_index.h"
+#include "nasm_formatter.h"
+#include "output_buffer.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "statistics.h"
+#include "timing.h"
+
+// Formats every instruction that starts in `code` and returns the number of
+// bytes consumed; a non-final window leaves a possibly partial tail behind.
+// An instruction cut off by the end of the input is an error.
+template<typename Formatter>
+static std::size_t formatWindow(std::span<const u8> code, std::size_t origin, bool final, Formatter& formatter) {
+    InstructionDecoder decoder(code, origin, final);
+    std::array<DecodedInstruction, 1024> batch;
+
+    while (std::size_t count = decoder.decode(batch.data(), batch.size())) {
+        for (std::size_t i = 0; i < count; i++) {
+            formatter.format(batch[i]);
         }
     }
 
-private:
-    std::vector<u8> code;
-    std::size_t pc = 0;
-    std::string ctx = "";
-
-    struct OpcodeEntry {
-        void(InstructionDecoder::*handler)(u8, std::string);
-        std::string mnemonic;
-    };
-
-    class ContextGuard {
-        std::string& ctx_ref;
-    public:
-        ContextGuard(std::string& ctx) : ctx_ref(ctx) {};
-        ~ContextGuard() { ctx_ref = ""; }
-    };
-
-    static std::array<OpcodeEntry, 256>& getOpcodeTable() {
-        static std::array<OpcodeEntry, 256> table = []() {
-            std::array<OpcodeEntry, 256> t;
-            t.fill({&InstructionDecoder::unknownOpcode, ""});
-
-            for (u8 i = 0x00; i <= 0x03; i++) {
-                t[i] = {&InstructionDecoder::decodeRegMem, "add"};
-            }
-
-            for (u8 i = 0x04; i <= 0x05; i++) {
-                t[i] = {&InstructionDecoder::decodeAccMem, "add"};
-            }
-
-            for (u8 i = 0x06; i <= 0x07; i++) {
-                t[i] = {&InstructionDecoder::decodeSegRegPushPop, ""};
-            }
-
-            for (u8 i = 0x08; i <= 0x0B; i++) {
-                t[i] = {&InstructionDecoder::decodeRegMem, "or"};
-            }
-
-            for (u8 i = 0x0C; i <= 0x0D; i++) {
-                t[i] = {&InstructionDecoder::decodeAccMem, "or"};
-            }
-
-            for (u8 i = 0x0E; i <= 0x0F; i++) {
-                t[i] = {&InstructionDecoder::decodeSegRegPushPop, ""};
-            }
-
-            for (u8 i = 0x10; i <= 0x13; i++) {
-                t[i] = {&InstructionDecoder::decodeRegMem, "adc"};
-            }
-
-            for (u8 i = 0x14; i <= 0x15; i++) {
-                t[i] = {&InstructionDecoder::decodeAccMem, "adc"};
-            }
-
-            for (u8 i = 0x16; i <= 0x17; i++) {
-                t[i] = {&InstructionDecoder::decodeSegRegPushPop, ""};
-            }
-
-            for (u8 i = 0x18; i <= 0x1B; i++) {
-                t[i] = {&InstructionDecoder::decodeRegMem, "sbb"};
-            }
-
-            for (u8 i = 0x1C; i <= 0x1D; i++) {
-                t[i] = {&InstructionDecoder::decodeAccMem, "sbb"};
-            }
-
-            for (u8 i = 0x1E; i <= 0x1F; i++) {
-                t[i] = {&InstructionDecoder::decodeSegRegPushPop, ""};
-            }
-
-            for (u8 i = 0x20; i <= 0x23; i++) {
-                t[i] = {&InstructionDecoder::decodeRegMem, "and"};
-            }
-
-            for (u8 i = 0x24; i <= 0x25; i++) {
-                t[i] = {&InstructionDecoder::decodeAccMem, "and"};
-            }
-
-            for (u8 i = 0x28; i <= 0x2B; i++) {
-                t[i] = {&InstructionDecoder::decodeRegMem, "sub"};
-            }
-
-            for (u8 i = 0x2C; i <= 0x2D; i++) {
-                t[i] = {&InstructionDecoder::decodeAccMem, "sub"};
-            }
-
-            for (u8 i = 0x30; i <= 0x33; i++) {
-                t[i] = {&InstructionDecoder::decodeRegMem, "xor"};
-            }
-
-            for (u8 i = 0x34; i <= 0x35; i++) {
-                t[i] = {&InstructionDecoder::decodeAccMem, "xor"};
-            }
-
-            for (u8 i = 0x38; i <= 0x3B; i++) {
-                t[i] = {&InstructionDecoder::decodeRegMem, "cmp"};
-            }
-
-            for (u8 i = 0x3C; i <= 0x3D; i++) {
-                t[i] = {&InstructionDecoder::decodeAccMem, "cmp"};
-            }
-
-            for (u8 i = 0x40; i <= 0x4F; i++) {
-                t[i] = {&InstructionDecoder::decodeIncDec, ""};
-            }
-
-            for (u8 i = 0x50; i <= 0x5F; i++) {
-                t[i] = {&InstructionDecoder::decodePushPop, ""};
-            }
-
-            for (u8 i = 0x70; i <= 0x7F; i++) {
-                t[i] = {&InstructionDecoder::decodeConJmp, ""};
-            }
-
-            for (u8 i = 0x80; i <= 0x83; i++) {
-                t[i] = {&InstructionDecoder::decodeImmRegMem, ""};
-            }
-
-            for (u8 i = 0x84; i <= 0x85; i++) {
-                t[i] = {&InstructionDecoder::decodeRegMem, "test"};
-            }
-
-            for (u8 i = 0x86; i <= 0x87; i++) {
-                t[i] = {&InstructionDecoder::decodeXchgRegMem, "xchg"};
-            }
-
-            for (u8 i = 0x88; i <= 0x8B; i++) {
-                t[i] = {&InstructionDecoder::decodeRegMem, "mov"};
-            }
-
-            for (u8 i = 0x90; i <= 0x97; i++) {
-                t[i] = {&InstructionDecoder::decodeXchgAccMem, "xchg"};
-            }
-
-            for (u8 i = 0xA0; i <= 0xA3; i++) {
-                t[i] = {&InstructionDecoder::decodeMovAccMem, "mov"};
-            }
-
-            for (u8 i = 0xA4; i <= 0xA7; i++) {
-                t[i] = {&InstructionDecoder::decodeStrOps, ""};
-            }
-
-            for (u8 i = 0xA8; i <= 0xA9; i++) {
-                t[i] = {&InstructionDecoder::decodeAccMem, "test"};
-            }
-
-            for (u8 i = 0xAA; i <= 0xAF; i++) {
-                t[i] = {&InstructionDecoder::decodeStrOps, ""};
-            }
-
-            for (u8 i = 0xB0; i <= 0xBF; i++) {
-                t[i] = {&InstructionDecoder::decodeImmToReg, "mov"};
-            }
-
-            for (u8 i = 0xC6; i <= 0xC7; i++) {
-                t[i] = {&InstructionDecoder::decodeImmToMem, "mov"};
-            }
-
-            for (u8 i = 0xCC; i <= 0xCF; i++) {
-                t[i] = {&InstructionDecoder::decodeInt, ""};
-            }
-
-            for (u8 i = 0xD0; i <= 0xD3; i++) {
-                t[i] = {&InstructionDecoder::decodeShtRot, ""};
-            }
-
-            for (u8 i = 0xD8; i <= 0xDF; i++) {
-                t[i] = {&InstructionDecoder::decodeESC, "esc"};
-            }
-
-            for (u8 i = 0xE0; i <= 0xE3; i++) {
-                t[i] = {&InstructionDecoder::decodeLoop, ""};
-            }
-
-            for (u8 i = 0xE4; i <= 0xE7; i++) {
-                t[i] = {&InstructionDecoder::decodeInOut, ""};
-            }
-
-            for (u8 i = 0xEC; i <= 0xEF; i++) {
-                t[i] = {&InstructionDecoder::decodeInOut, ""};
-            }
-
-            for (u8 i = 0xF2; i <= 0xF3; i++) {
-                t[i] = {&InstructionDecoder::decodeRepPrefix, ""};
-            }
-
-            for (u8 i = 0xF6; i <= 0xF7; i++) {
-                t[i] = {&InstructionDecoder::decodeGrp3, ""};
-            }
-
-            for (u8 i = 0xF8; i <= 0xFD; i++) {
-                t[i] = {&InstructionDecoder::decodeFlagOps, ""};
-            }
-
-            t[0x26] = {&InstructionDecoder::decodeSegmentPrefix, "es:"};
-            t[0x27] = {&InstructionDecoder::decodeNullaryInstruction, "daa"};
-            t[0x2E] = {&InstructionDecoder::decodeSegmentPrefix, "cs:"};
-            t[0x2F] = {&InstructionDecoder::decodeNullaryInstruction, "das"};
-            t[0x36] = {&InstructionDecoder::decodeSegmentPrefix, "ss:"};
-            t[0x37] = {&InstructionDecoder::decodeNullaryInstruction, "aaa"};
-            t[0x3E] = {&InstructionDecoder::decodeSegmentPrefix, "ds:"};
-            t[0x3F] = {&InstructionDecoder::decodeNullaryInstruction, "aas"};
-            t[0x8C] = {&InstructionDecoder::decodeRegSegReg, "mov"};
-            t[0x8D] = {&InstructionDecoder::decodeLoads, "lea"};
-            t[0x8E] = {&InstructionDecoder::decodeRegSegReg, "mov"};
-            t[0x8F] = {&InstructionDecoder::decodeRegMem16, "pop"};
-            t[0x98] = {&InstructionDecoder::decodeNullaryInstruction, "cbw"};
-            t[0x99] = {&InstructionDecoder::decodeNullaryInstruction, "cwd"};
-            t[0x9A] = {&InstructionDecoder::decodeControlTransfer, "call"};
-            t[0x9B] = {&InstructionDecoder::decodeNullaryInstruction, "wait"};
-            t[0x9C] = {&InstructionDecoder::decodeNullaryInstruction, "pushf"};
-            t[0x9D] = {&InstructionDecoder::decodeNullaryInstruction, "popf"};
-            t[0x9E] = {&InstructionDecoder::decodeNullaryInstruction, "sahf"};
-            t[0x9F] = {&InstructionDecoder::decodeNullaryInstruction, "lahf"};
-            t[0xD4] = {&InstructionDecoder::decodeNullaryInstructionTwoBytes, "aam"};
-            t[0xD5] = {&InstructionDecoder::decodeNullaryInstructionTwoBytes, "aad"};
-            t[0xD7] = {&InstructionDecoder::decodeNullaryInstruction, "xlat"};
-            t[0xC2] = {&InstructionDecoder::decodeRets, "ret"};
-            t[0xC3] = {&InstructionDecoder::decodeRets, "ret"};
-            t[0xC4] = {&InstructionDecoder::decodeLoads, "les"};
-            t[0xC5] = {&InstructionDecoder::decodeLoads, "lds"};
-            t[0xCA] = {&InstructionDecoder::decodeRets, "retf"};
-            t[0xCB] = {&InstructionDecoder::decodeRets, "retf"};
-            t[0xE8] = {&InstructionDecoder::decodeControlTransfer, "call"};
-            t[0xE9] = {&InstructionDecoder::decodeControlTransfer, "jmp"};
-            t[0xEA] = {&InstructionDecoder::decodeControlTransfer, "jmp"};
-            t[0xEB] = {&InstructionDecoder::decodeControlTransfer, "jmp"};
-            t[0xF0] = {&InstructionDecoder::decodeNullaryPrefix, "lock"};
-            t[0xF4] = {&InstructionDecoder::decodeNullaryInstruction, "hlt"};
-            t[0xF5] = {&InstructionDecoder::decodeNullaryInstruction, "cmc"};
-            t[0xF8] = {&InstructionDecoder::decodeNullaryInstruction, "clc"};
-            t[0xF9] = {&InstructionDecoder::decodeNullaryInstruction, "stc"};
-            t[0xFA] = {&InstructionDecoder::decodeNullaryInstruction, "cli"};
-            t[0xFB] = {&InstructionDecoder::decodeNullaryInstruction, "sti"};
-            t[0xFC] = {&InstructionDecoder::decodeNullaryInstruction, "cld"};
-            t[0xFD] = {&InstructionDecoder::decodeNullaryInstruction, "std"};
-            t[0xFE] = {&InstructionDecoder::decodeGrp5, ""};
-            t[0xFF] = {&InstructionDecoder::decodeGrp5, ""};
-
-            return t;
-        }();
-
-        return table;
-    }
-
-    void unknownOpcode(u8 opcode, std::string mnemonic) {
-        std::cout << "[WARNING] Unknown opcode " << std::format("0x{:02x}", int(opcode))
-            << " at position " << std::dec << pc << '\n';
-        pc++;
-    }
-
-    void decodeXchgRegMem(u8 opcode, std::string mnemonic) {
-        u8 w = opcode & 1;
-
-        if (!isIndexValid(1)) return;
-
-        u8 modrm = code[pc + 1];
-        u8 mod = (modrm >> 6) & 3;
-        u8 reg = (modrm >> 3) & 7;
-        u8 rm = modrm & 7;
-
-        pc += 2;
+    if (decoder.truncated()) throw truncatedInstruction(decoder.truncation());
+    return decoder.position();
+}
 
-        std::cout << mnemonic << " " << getRM(mod, rm, w) << ", " << getRegister(reg, w) << '\n';
+// Formats a whole input: the loaded image of a mapped file, or a stream read through one window.
+template<typename Formatter>
+static void formatInput(const InputFile& input, const ExecutableImage& image, Formatter& formatter) {
+    if (input.isMapped()) {
+        formatWindow(image.code, image.origin, true, formatter);
+        return;
     }
 
-    void decodeRegMem(u8 opcode, std::string mnemonic) {
-        u8 d = (opcode >> 1) & 1;
-        u8 w = opcode & 1;
-
-        if (!isIndexValid(1)) return;
-
-        u8 modrm = code[pc + 1];
-        u8 mod = (modrm >> 6) & 3;
-        u8 reg = (modrm >> 3) & 7;
-        u8 rm = modrm & 7;
-
-        pc += 2;
+    ChunkReader reader(input.descriptor());
+    std::size_t consumed = 0;
+    do {
+        std::span<const u8> window = reader.next(consumed);
+        consumed = formatWindow(window, reader.origin(), reader.eof(), formatter);
+    } while (!reader.eof());
+}
 
-        if (d) {
-            std::cout << mnemonic << " " << getRegister(reg, w) << ", " << getRM(mod, rm, w) << '\n';
-        } else {
-            std::cout << mnemonic << " " << getRM(mod, rm, w) << ", " << getRegister(reg, w) << '\n';
-        }
+// Counts the image like formatInput decodes it; a truncated tail is counted, not an error.
+static void scanStatistics(const InputFile& input, const ExecutableImage& image, DecodeStatistics& stats) {
+    StatisticsScanner scanner(stats);
+    if (input.isMapped()) {
+        scanner.scan(image.code);
+        return;
     }
 
-    void decodeRets(u8 opcode, std::string mnemonic) {
-        u8 has_imm = !(opcode & 1);
+    ChunkReader reader(input.descriptor());
+    std::size_t consumed = 0;
+    do {
+        std::span<const u8> window = reader.next(consumed);
+        consumed = scanner.scan(window, reader.eof());
+    } while (!reader.eof());
+}
 
-        pc++;
+// Formats the records that start in [start, end). Decoding begins at the
+// closest checkpoint of the image's index, which is built and saved on first use.
+static void formatRange(const InputFile& input, const std::string& path, std::size_t start, std::size_t end, NasmFormatter& formatter) {
+    std::span<const u8> code = input.bytes();
+    end = std::min(end, code.size());
+    if (start >= end) return;
 
-        if (has_imm) {
-            std::cout << mnemonic << " " << std::to_string(static_cast<i16>(readU16())) << '\n';
-        } else {
-            std::cout << mnemonic << '\n';
-        }
+    std::string index_path = path + ".idx";
+    CheckpointIndex index;
+    if (!index.load(index_path, code, input.modified())) {
+        index = CheckpointIndex::build(code, input.modified());
+        index.save(index_path);
     }
 
-    void decodeLoads(u8 opcode, std::string mnemonic) {
-        u8 w = 1;
-
-        if (!isIndexValid(1)) return;
+    std::size_t first = index.boundaryAtOrAfter(code, start);
+    std::size_t window_end = std::min(end + kMaxInstructionLength - 1, code.size());
+    InstructionStream stream(code.subspan(first, window_end - first), first, window_end == code.size());
 
-        u8 modrm = code[pc + 1];
-        u8 mod = (modrm >> 6) & 3;
-        u8 reg = (modrm >> 3) & 7;
-        u8 rm = modrm & 7;
-
-        pc += 2;
-
-        std::cout << mnemonic << " " << getRegister(reg, w) << ", " << getRM(mod, rm, w) << '\n';
+    for (const DecodedInstruction& instr : stream) {
+        if (instr.offset >= end) return;
+        formatter.format(instr);
     }
+    if (stream.truncated() && stream.position() < end) throw truncatedInstruction(stream.truncation());
+}
 
-    void decodeRegSegReg(u8 opcode, std::string mnemonic) {
-        u8 is_to_segReg = (opcode >> 1) & 1;
-
-        if (!isIndexValid(1)) return;
-
-        u8 modrm = code[pc + 1];
-        u8 mod = (modrm >> 6) & 3;
-        u8 sr = (modrm >> 3) & 3;
-        u8 rm = modrm & 7;
-
-        pc += 2;
-
-        if (is_to_segReg) {
-            std::cout << mnemonic << " " << getSegReg(sr) << ", " << getRM(mod, rm, 1) << '\n';
-        } else {
-            std::cout << mnemonic << " " << getRM(mod, rm, 1) << ", " << getSegReg(sr) << '\n';
+// Formats the reachable code block by block, each under a comment naming
+// its start and successors, and with `timing` the clocks to run it once.
+static void formatGraph(const ControlFlowGraph& graph, NasmFormatter& formatter, OutputBuffer& output, const TimingModel* timing) {
+    for (const BasicBlock& block : graph.blocks) {
+        output.reserve(96);
+        output.put("\n; block 0x");
+        output.putInt(block.begin, 16);
+        for (u8 i = 0; i < block.successor_count; i++) {
+            output.put(i == 0 ? " -> 0x" : ", 0x");
+            output.putInt(graph.blocks[block.successors[i]].begin, 16);
         }
-    }
-
-    void decodeMovAccMem(u8 opcode, std::string mnemonic) {
-        u8 w = opcode & 1;
-
-        pc++;
-
-        u16 addr = (w) ? readU16() : readU8();
-
-        if ((opcode >> 1) & 1) {
-            std::cout << mnemonic << " [" << std::to_string(addr) << "], " << getRegister(0, w) << '\n';
-        } else {
-            std::cout << mnemonic << " " << getRegister(0, w) << ", [" << std::to_string(addr) << "]" << '\n';
+        if (timing) {
+            u64 clocks = 0;
+            for (std::size_t i = block.first; i < block.first + block.count; i++) {
+                clocks += timing->estimate(graph.instructions[i]).total();
+            }
+            output.put(", clocks: ");
+            output.putInt(clocks);
         }
-    }
-
-    void decodeXchgAccMem(u8 opcode, std::string mnemonic) {
-        u8 reg = opcode & 7;
-
-        pc++;
-
-        std::cout << mnemonic << " ax, " << getRegister(reg, 1) << '\n';
-    }
-
-    void decodeAccMem(u8 opcode, std::string mnemonic) {
-        u8 w = opcode & 1;
-
-        pc++;
-
-        i16 data = (w) ? static_cast<i16>(readU16()) : static_cast<i8>(readU8());
-
-        std::cout << mnemonic << " " << getRegister(0, w) << ", " << std::to_string(data) << '\n';
-    }
-
-    void decodeStrOps(u8 opcode, std::string mnemonic) {
-        const char* instr[] = {"movs", "cmps", "", "stos", "lods", "scas"};
-
-        u8 w = opcode & 1;
-        u8 reg = (opcode - 0xA4) >> 1;
+        output.put('\n');
 
-        pc++;
-
-        std::cout << instr[reg] << ((w) ? 'w' : 'b') << '\n';
-    }
-
-
-    void decodeIncDec(u8 opcode, std::string mnemonic) {
-        u8 is_dec = (opcode >> 3) & 1;
-        u8 reg = opcode & 7;
-
-        pc++;
-
-        std::cout << ((is_dec) ? "dec " : "inc ") << getRegister(reg, 1) << '\n';
-    }
-
-    void decodeSegRegPushPop (u8 opcode, std::string mnemonic) {
-        u8 is_pop = opcode & 1;
-        u8 sr = (opcode >> 3) & 3;
-
-        pc++;
-
-        std::cout << ((is_pop) ? "pop " : "push ") << getSegReg(sr) << '\n';
+        for (std::size_t i = block.first; i < block.first + block.count; i++) {
+            formatter.format(graph.instructions[i]);
+        }
     }
 
-
-    void decodePushPop(u8 opcode, std::string mnemonic) {
-        u8 is_pop = (opcode >> 3) & 1;
-        u8 reg = opcode & 7;
-
-        pc++;
-
-        std::cout << ((is_pop) ? "pop " : "push ") << getRegister(reg, 1) << '\n';
+    for (std::size_t offset : graph.truncated) {
+        std::cerr << "[WARNING] Truncated instruction at position " << offset << std::endl;
     }
+}
 
-    void decodeConJmp(u8 opcode, std::string mnemonic) {
-        const char* jumpNames[] = {
-            "jo", "jno", "jb", "jnb", "je", "jne", "jbe", "jnbe",
-            "js", "jns", "jp", "jnp", "jl", "jnl", "jle", "jnle"
-        };
-
-        pc++;
-        i8 disp = static_cast<i8>(readU8());
-        std::cout << jumpNames[opcode - 0x70] << ((disp >= 0) ? " $+ " : " $- ") << ((disp >= 0) ? disp + 2 : -(disp + 2)) << '\n';
-    }
-
-    void decodeImmRegMem(u8 opcode, std::string mnemonic) {
-        u8 w = opcode & 1;
-        u8 s = (opcode >> 1) & 1;
-
-        if (!isIndexValid(1)) return;
-
-        u8 modrm = code[pc + 1];
-        u8 mod = (modrm >> 6) & 3;
-        u8 reg = (modrm >> 3) & 7;
-        u8 rm = modrm & 7;
-
-        pc += 2;
-
-        const char* instr[] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"};
-
-        std::string size = (mod != 3) ? ((w) ? " word" : " byte") : "";
-        std::string mem = getRM(mod, rm, w); //getRM first to increment pc counter correctly for data
-        u16 data = (w && !s) ? readU16() : readU8();
+// Runs every record through an idiom automaton and formats only the records
+// of each match, under a comment with its offset and the idiom. Takes the
+// place of a formatter, so any decode loop can drive it.
+class MatchPrinter {
+public:
+    MatchPrinter(const IdiomSet& idioms, OutputBuffer& output) : idioms(idioms), matcher(idioms), formatter(output), output(output) {}
 
-        std::cout << instr[reg] << size << " " << mem << ", " << std::to_string(data) << '\n';
+    void format(const DecodedInstruction& instr) {
+        matcher.step(instr, [this](std::size_t idiom, std::size_t length) {
+            std::string_view text = idioms.text(idiom);
+            output.reserve(text.size() + 48);
+            output.put("; match at 0x");
+            output.putInt(matcher.recent(length - 1).offset, 16);
+            output.put(": ");
+            output.put(text);
+            output.put('\n');
+            for (std::size_t back = length; back-- > 0;) formatter.format(matcher.recent(back));
+        });
     }
 
-    void decodeInOut(u8 opcode, std::string mnemonic) {
-        u8 is_out = (opcode >> 1) & 1;
-        u8 is_dx = (opcode >> 3) & 1;
-        u8 w = opcode & 1;
-
-        pc++;
-        if (is_dx) {
-            std::cout << ((is_out) ? "out " : "in ") << ((is_out) ? "dx, " : getRegister(0, w)) << ((is_out) ? getRegister(0, w) : ", dx") << '\n';
-        } else {
-            std::cout << ((is_out) ? "out " : "in ") << ((is_out) ? std::to_string(readU8()) : getRegister(0, w)) << ", " << ((is_out) ? getRegister(0, w) : std::to_string(readU8())) << '\n';
-        }
-    }
+private:
+    const IdiomSet& idioms;
+    IdiomMatcher matcher;
+    NasmFormatter formatter;
+    OutputBuffer& output;
+};
 
-    void decodeControlTransfer(u8 opcode, std::string mnemonic) {
-        pc++;
-
-        if (opcode == 0x9A || opcode == 0xEA) {
-            u16 displacement = readU16();
-            u16 segment = readU16();
-            std::cout << mnemonic << " " << segment << ":" << displacement << '\n';
-        } else if (opcode == 0xE8 || opcode == 0xE9) {
-            i16 displacement = static_cast<i16>(readU16());
-            i16 target_displacement = displacement + pc;
-            std::cout << mnemonic << " " << target_displacement << '\n';
-        } else {
-            std::cout << mnemonic << " " << readU8() << '\n';
+// Idioms from --find arguments and --find-file lists (one per line, `#` starts a comment line).
+static IdiomSet loadIdioms(const std::vector<std::string>& finds, const std::vector<std::string>& find_files) {
+    IdiomSet idioms;
+    for (const std::string& text : finds) idioms.add(text);
+    for (const std::string& path : find_files) {
+        std::ifstream file(path);
+        if (!file) throw std::runtime_error("[ERROR] Cannot open idiom file: " + path);
+        for (std::string line; std::getline(file, line);) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos || line[line.find_first_not_of(" \t")] == '#') continue;
+            if (line.back() == '\r') line.pop_back();
+            idioms.add(line);
         }
     }
+    idioms.finish();
+    return idioms;
+}
 
-    void decodeGrp3(u8 opcode, std::string mnemonic) {
-        const char* instr[] = {"test", "", "not", "neg", "mul", "imul", "div", "idiv"};
-        u8 w = opcode & 1;
-
-        if (!isIndexValid(1)) return;
-
-        u8 modrm = code[pc + 1];
-        u8 mod = (modrm >> 6) & 3;
-        u8 reg = (modrm >> 3) & 7;
-        u8 rm = modrm & 7;
-
-        pc += 2;
+static void putTotalClocks(const NasmFormatter& formatter, OutputBuffer& output) {
+    output.reserve(64);
+    output.put("\n; total clocks: ");
+    output.putInt(formatter.totalClocks());
+    output.put('\n');
+}
 
-        std::string size = (mod != 3) ? ((w) ? " word" : " byte") : "";
-        std::string mem = getRM(mod, rm, w);
+// Four hex digits, no prefix.
+static void putHex4(OutputBuffer& output, u16 value) {
+    for (int shift = 12; shift >= 0; shift -= 4) output.put("0123456789abcdef"[(value >> shift) & 0xF]);
+}
 
-        if (reg == 0) {
-            u16 data = (w) ? readU16() : readU8();
-            std::cout << instr[reg] << size << " " << mem << ", " << std::to_string(data) << '\n';
-        } else {
-            std::cout << instr[reg] << size << " " << mem << '\n';
-        }
-    }
+static void putHex16(OutputBuffer& output, u16 value) {
+    output.put("0x");
+    putHex4(output, value);
+}
 
-    void decodeGrp5(u8 opcode, std::string mnemonic) {
-        const char* instr[] =  {"inc", "dec", "call", "call far", "jmp", "jmp far", "push", ""};
+// "; MZ load module: 0x1f40 bytes at file offset 0x200, entry 0000:0010 (0x10), 3 relocations, 0x400 bytes after it skipped"
+static void putImageInfo(const ExecutableImage& image, OutputBuffer& output) {
+    if (image.format != ImageFormat::Mz) return;
+
+    output.reserve(160);
+    output.put("; MZ load module: 0x");
+    output.putInt(image.code.size(), 16);
+    output.put(" bytes at file offset 0x");
+    output.putInt(image.file_offset, 16);
+    output.put(", entry ");
+    putHex4(output, image.entry_cs);
+    output.put(':');
+    putHex4(output, image.entry_ip);
+    output.put(" (0x");
+    output.putInt(image.entry, 16);
+    output.put("), ");
+    output.putInt(image.relocations.size());
+    output.put(image.relocations.size() == 1 ? " relocation" : " relocations");
+    if (image.skipped) {
+        output.put(", 0x");
+        output.putInt(image.skipped, 16);
+        output.put(" bytes after it skipped");
+    }
+    output.put("\n\n");
+}
 
-        if (!isIndexValid(1)) return;
-        u8 modrm = code[pc + 1];
-        u8 reg = (modrm >> 3) & 7;
+// Writes the registers that are not zero, then the flags that are set.
+static void formatRegisters(const Cpu& cpu, std::size_t steps, OutputBuffer& output) {
+    constexpr std::string_view names[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "es", "cs", "ss", "ds", "ip"};
+    const CpuState& state = cpu.state();
+    u16 values[13];
+    std::copy(state.regs.begin(), state.regs.end(), values);
+    std::copy(state.segs.begin(), state.segs.end(), values + 8);
+    values[12] = state.ip;
+
+    output.reserve(64);
+    output.put("Executed ");
+    output.putInt(steps);
+    output.put(" instructions\nFinal registers:\n");
+
+    for (int i = 0; i < 13; i++) {
+        if (!values[i]) continue;
+        output.reserve(64);
+        output.put("      ");
+        output.put(names[i]);
+        output.put(": ");
+        putHex16(output, values[i]);
+        output.put(" (");
+        output.putInt(values[i]);
+        output.put(")\n");
+    }
+
+    constexpr std::pair<u16, char> flags[] = {
+        {Flag::Carry, 'C'}, {Flag::Parity, 'P'}, {Flag::Auxiliary, 'A'}, {Flag::Zero, 'Z'}, {Flag::Sign, 'S'},
+        {Flag::Trap, 'T'}, {Flag::Interrupt, 'I'}, {Flag::Direction, 'D'}, {Flag::Overflow, 'O'}};
+    if (!(state.flags & Flag::All)) return;
+
+    output.reserve(64);
+    output.put("   flags: ");
+    for (auto [mask, name] : flags) {
+        if (state.flags & mask) output.put(name);
+    }
+    output.put('\n');
+}
 
-        decodeRegMem16(opcode, instr[reg]);
+// Reads a whole unsigned number written as strtoull reads it with base 0
+// (decimal, 0x hex, or octal with a leading 0), but rejects signs and trailing text.
+static bool parseNumber(std::string_view text, std::size_t& value) {
+    int base = 10;
+    if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        base = 16;
+        text.remove_prefix(2);
+    } else if (text.size() > 1 && text[0] == '0') {
+        base = 8;
+        text.remove_prefix(1);
     }
 
-    void decodeRegMem16(u8 opcode, std::string mnemonic) {
-
-        u8 w = opcode & 1;
-
-        if (!isIndexValid(1)) return;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, base);
+    return error == std::errc() && end == text.data() + text.size();
+}
 
-        u8 modrm = code[pc + 1];
-        u8 mod = (modrm >> 6) & 3;
-        u8 reg = (modrm >> 3) & 7;
-        u8 rm = modrm & 7;
+// Parses OFFSET:OLD_LENGTH:HEXBYTES; the byte string may be empty to delete.
+static Patch parsePatch(const std::string& text) {
+    std::string_view view = text;
+    std::size_t first = view.find(':');
+    std::size_t second = view.find(':', first + 1);
+    bool valid = first != std::string_view::npos && second != std::string_view::npos && (view.size() - second - 1) % 2 == 0;
+
+    Patch patch;
+    valid = valid && parseNumber(view.substr(0, first), patch.offset)
+        && parseNumber(view.substr(first + 1, second - first - 1), patch.old_length);
+    for (std::size_t i = second + 1; valid && i < view.size(); i += 2) {
+        u8 byte = 0;
+        auto [end, error] = std::from_chars(view.data() + i, view.data() + i + 2, byte, 16);
+        valid = error == std::errc() && end == view.data() + i + 2;
+        patch.bytes.push_back(byte);
+    }
+    if (!valid) throw std::runtime_error("[ERROR] Patches are OFFSET:OLD_LENGTH:HEXBYTES, got: " + text);
+    return patch;
+}
 
-        pc += 2;
-        if (2 <= reg && reg <= 5) {
-            std::cout << mnemonic << " " << getRM(mod, rm, w) << '\n';
-        } else {
-            std::cout << mnemonic << " " << getRM(mod, rm, w, true) << '\n';
+// Applies each patch in turn and prints only the records it changed.
+static void formatPatches(const InputFile& input, const std::vector<Patch>& patches, NasmFormatter& formatter, OutputBuffer& output) {
+    IncrementalDecoder decoder({input.bytes().begin(), input.bytes().end()});
+
+    for (const Patch& patch : patches) {
+        PatchResult result = decoder.apply(patch);
+
+        output.reserve(128);
+        output.put("; patch at 0x");
+        output.putInt(patch.offset, 16);
+        output.put(": records ");
+        output.putInt(result.first);
+        output.put("..");
+        output.putInt(result.first + result.removed);
+        output.put(" replaced by ");
+        output.putInt(result.inserted);
+        output.put(", bytes 0x");
+        output.putInt(result.begin, 16);
+        output.put("..0x");
+        output.putInt(result.end, 16);
+        output.put('\n');
+
+        for (const DecodedInstruction& instr : decoder.instructions().subspan(result.first, result.inserted)) {
+            formatter.format(instr);
         }
     }
 
-    void decodeImmToReg(u8 opcode, std::string mnemonic) {
-        u8 w = (opcode >> 3) & 1;
-        u8 reg = opcode & 7;
-
-        pc++;
-
-        if (w) {
-            std::cout << mnemonic << " " << getRegister(reg, w) << ", " << std::to_string(static_cast<i16>(readU16())) << '\n';
-        } else {
-            std::cout << mnemonic << " " << getRegister(reg, w) << ", " << std::to_string(static_cast<i8>(readU8())) << '\n';
-        }
+    if (decoder.truncated()) {
+        std::cerr << "[WARNING] Truncated instruction at position " << decoder.truncatedAt() << std::endl;
     }
+}
 
-    void decodeImmToMem(u8 opcode, std::string mnemonic) {
-        u8 w = opcode & 1;
-
-        if (!isIndexValid(1)) return;
-
-        u8 modrm = code[pc + 1];
-        u8 mod = (modrm >> 6) & 3;
-        u8 rm = modrm & 7;
-
-        pc += 2;
-
-        if (w) {
-            std::cout << mnemonic << " " << getRM(mod, rm, w) << ", word " << std::to_string(readU16()) << '\n';
-        } else {
-            std::cout << mnemonic << " " << getRM(mod, rm, w) << ", byte " << std::to_string(readU8()) << '\n';
-        }
+static int finishOutput(OutputBuffer& output) {
+    if (!output.flush()) {
+        std::cerr << "[ERROR] Cannot write output." << std::endl;
+        return 1;
     }
+    return 0;
+}
 
-    void decodeInt(u8 opcode, std::string mnemonic) {
-        const char* ints[] = {"int3", "int", "into", "iret"};
-
-        pc++;
-        if (opcode - 0xCC != 1) {
-            std::cout << ints[opcode - 0xCC] << '\n';
+int main(int argc, char* argv[]) {
+    unsigned threads = 1;
+    bool threads_set = false;
+    bool batch = false;
+    bool per_file = false;
+    bool to_binary = false;
+    bool from_binary = false;
+    const char* cache_dir = nullptr;
+    std::vector<std::string> patch_args;
+    bool recursive = false;
+    bool use_labels = false;
+    bool execute = false;
+    // A program that never halts (`jmp $`) must still end; --max-steps raises this.
+    std::size_t max_steps = 100'000'000;
+    bool statistics = false;
+    std::optional<TimingModel> timing;
+    std::size_t range_start = 0;
+    std::size_t range_end = SIZE_MAX;
+    bool ranged = false;
+    std::vector<std::size_t> entry_points;
+    std::optional<ImageFormat> format;
+    std::vector<std::string> finds;
+    std::vector<std::string> find_files;
+    std::vector<std::string> paths;
+    bool usage_error = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            std::size_t count;
+            if (!parseNumber(argv[++i], count) || count > std::numeric_limits<unsigned>::max()) {
+                usage_error = true;
+                break;
+            }
+            threads = static_cast<unsigned>(count);
+            if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+            threads_set = true;
+        } else if (arg == "-b") {
+            batch = true;
+        } else if (arg == "--per-file") {
+            batch = true;
+            per_file = true;
+        } else if ((arg == "--start" || arg == "--end") && i + 1 < argc) {
+            if (!parseNumber(argv[++i], (arg == "--start") ? range_start : range_end)) {
+                usage_error = true;
+                break;
+            }
+            ranged = true;
+        } else if (arg == "-t" && i + 1 < argc) {
+            std::string model = argv[++i];
+            if (model == "8086") {
+                timing.emplace(CpuModel::I8086);
+            } else if (model == "8088") {
+                timing.emplace(CpuModel::I8088);
+            } else {
+                usage_error = true;
+                break;
+            }
+        } else if (arg == "--format" && i + 1 < argc) {
+            format = parseImageFormat(argv[++i]);
+            if (!format) {
+                usage_error = true;
+                break;
+            }
+        } else if (arg == "--find" && i + 1 < argc) {
+            finds.push_back(argv[++i]);
+        } else if (arg == "--find-file" && i + 1 < argc) {
+            find_files.push_back(argv[++i]);
+        } else if (arg == "--binary") {
+            to_binary = true;
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (arg == "--patch" && i + 1 < argc) {
+            patch_args.push_back(argv[++i]);
+        } else if (arg == "--from-binary") {
+            from_binary = true;
+        } else if (arg == "--stats") {
+            statistics = true;
+        } else if (arg == "-x") {
+            execute = true;
+        } else if (arg == "--max-steps" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], max_steps)) {
+                usage_error = true;
+                break;
+            }
+        } else if (arg == "-l") {
+            use_labels = true;
+        } else if (arg == "-r") {
+            recursive = true;
+        } else if (arg == "-e" && i + 1 < argc) {
+            recursive = true;
+            std::size_t entry;
+            if (!parseNumber(argv[++i], entry)) {
+                usage_error = true;
+                break;
+            }
+            entry_points.push_back(entry);
         } else {
-            std::cout << ints[opcode - 0xCC] << " " << std::to_string(readU8()) << '\n';
+            paths.push_back(arg);
         }
     }
 
-    void decodeShtRot(u8 opcode, std::string mnemonic) {
-        const char* instr[] = {"rol", "ror", "rcl", "rcr", "sal", "shr", "", "sar"};
-        const char* cnt[] = {"1", "cl"};
-
-        u8 w = opcode & 1;
-        u8 count = (opcode >> 1) & 1;
-
-        if (!isIndexValid(1)) return;
-
-        u8 modrm = code[pc + 1];
-        u8 mod = (modrm >> 6) & 3;
-        u8 reg = (modrm >> 3) & 7;
-        u8 rm = modrm & 7;
-
-        pc += 2;
-
-        std::cout << instr[reg] << " " << getRM(mod, rm, w, true) << ", " << cnt[count] << '\n';
-    }
-
-    void decodeESC(u8 opcode, std::string mnemonic) {
-        if (!isIndexValid(1)) return;
-
-        u8 modrm = code[pc + 1];
-        u8 mod = (modrm >> 6) & 3;
-        u8 reg = (modrm >> 3) & 7;
-        u8 rm = modrm & 7;
-
-        u8 cop_op = ((opcode & 7) << 3) | reg;
-
-        std::cout << mnemonic << " " << std::to_string(cop_op) << ", " << getRM(mod, rm, 1) << '\n';
+    if (batch && (recursive || execute || ranged)) usage_error = true;
+    if (range_start > range_end) usage_error = true;
+    if (!patch_args.empty() && (batch || recursive || use_labels || execute || ranged || timing || to_binary || from_binary)) usage_error = true;
+    if (format && (execute || ranged || from_binary || !patch_args.empty())) usage_error = true;
+    bool searching = !finds.empty() || !find_files.empty();
+    if (searching && (recursive || use_labels || execute || ranged || timing || to_binary || from_binary || !patch_args.empty())) usage_error = true;
+    if (statistics && (searching || per_file || recursive || use_labels || execute || ranged || timing || to_binary || from_binary || !patch_args.empty())) {
+        usage_error = true;
+    }
+    if ((to_binary || from_binary) && (batch || recursive || use_labels || execute || ranged || timing || (to_binary && from_binary))) {
+        usage_error = true;
+    }
+    if (usage_error || paths.empty() || (!batch && paths.size() > 1)) {
+        std::cout << "[ERROR] Usage: " << argv[0] << " [-j threads] [-l] [-r] [-x [--max-steps n]] [-t 8086|8088] [--format flat|com|exe] [--cache dir] [--start offset] [--end offset] [-e entry]... <filepath | ->" << std::endl;
+        std::cout << "       " << argv[0] << " --patch offset:old_length:hexbytes... <filepath>" << std::endl;
+        std::cout << "       " << argv[0] << " --binary [--format flat|com|exe] [--cache dir] <filepath | ->" << std::endl;
+        std::cout << "       " << argv[0] << " --from-binary <filepath>" << std::endl;
+        std::cout << "       " << argv[0] << " [-b] (--find idiom | --find-file file)... [--format flat|com|exe] <filepath | ->..." << std::endl;
+        std::cout << "       " << argv[0] << " [-b] [-j threads] --stats [--format flat|com|exe] <filepath | ->..." << std::endl;
+        std::cout << "       " << argv[0] << " -b|--per-file [-j threads] [-l] [-t 8086|8088] [--format flat|com|exe] <filepath | directory | @list>..." << std::endl;
+        return 1;
     }
 
-    void decodeLoop(u8 opcode, std::string mnemonic) {
-        const char* loopNames[] = {"loopne", "loope", "loop", "jcxz"};
+    OutputBuffer output(STDOUT_FILENO);
 
-        pc++;
-        i8 disp = static_cast<i8>(readU8());
-        std::cout << loopNames[opcode - 0xE0] << ((disp >= 0) ? " $+ " : " $- ") << ((disp >= 0) ? disp + 2 : -(disp + 2)) << '\n';
-    }
-
-    void decodeFlagOps(u8 opcode, std::string mnemonic) {
-        const char* flagOps[] = {"clc", "stc", "cli", "sti", "cld", "std"};
+    const TimingModel* model = timing ? &*timing : nullptr;
 
-        pc++;
-        std::cout << flagOps[opcode - 0xF8] << '\n';
+    IdiomSet idioms;
+    try {
+        if (searching) idioms = loadIdioms(finds, find_files);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
     }
 
-    void decodeRepPrefix(u8 opcode, std::string mnemonic) {
-        u8 is_rep = opcode & 1;
+    if (batch) {
+        if (!threads_set) threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+        std::size_t failed = 0;
+        try {
+            StatisticsTotals totals;
+            if (statistics) output.put(kStatisticsCsvHeader);
+
+            BatchDisassembler pool(threads, per_file, !statistics);
+            failed = pool.run(BatchDisassembler::collectPaths(paths), output, [&](const InputFile& input, const std::string& file, OutputBuffer& text) {
+                ExecutableImage image = loadExecutable(input.bytes(), file, format);
+                if (statistics) {
+                    StatisticsTotals::Slot& slot = totals.local();
+                    slot.file.clear();
+                    StatisticsScanner(slot.file).scan(image.code);
+                    writeStatisticsCsv(file, slot.file, text);
+                    slot.total.merge(slot.file);
+                    return;
+                }
+                if (searching) {
+                    MatchPrinter printer(idioms, text);
+                    formatWindow(image.code, image.origin, true, printer);
+                    return;
+                }
+
+                LabelIndex labels(use_labels ? image.origin + image.code.size() : 0);
+                NasmFormatter formatter(text, use_labels ? &labels : nullptr, model);
+                formatter.header(image.origin);
+                putImageInfo(image, text);
+                if (use_labels) labels.collect(image.code, image.origin);
+                formatWindow(image.code, image.origin, true, formatter);
+                if (model) putTotalClocks(formatter, text);
+            });
+            // Rows with no file name are the totals over every file.
+            if (statistics) writeStatisticsCsv("", *totals.merged(), output);
+        } catch (const std::runtime_error& e) {
+            output.flush();
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
 
-        pc++;
-        std::cout << ((is_rep) ? "rep " : "repne ");
+        return finishOutput(output) | (failed ? 1 : 0);
     }
 
-    void decodeNullaryInstruction(u8 opcode, std::string mnemonic) {std::cout << mnemonic << '\n'; pc++; }
-    void decodeNullaryInstructionTwoBytes(u8 opcode, std::string mnemonic) {std::cout << mnemonic << '\n'; pc += 2; }
-    void decodeSegmentPrefix(u8 opcode, std::string mnemonic) {this->ctx = mnemonic; pc++; }
-
-    void decodeNullaryPrefix(u8 opcode, std::string mnemonic) {std::cout << mnemonic << " "; pc++; }
-
-    std::string getRegister(u8 reg, u8 w) const {
-        const char* regs8[] = {"al", "cl", "dl", "bl", "ah", "ch", "dh", "bh"};
-        const char* regs16[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"};
-
-        return w ? regs16[reg] : regs8[reg];
-    }
+    const std::string& path = paths.front();
 
-    std::string getRM(u8 mod, u8 rm, u8 w, bool include_size = false) {
-        ContextGuard guard(this->ctx);
+    // With a cache, whole-image output is rendered in memory so it can be stored.
+    std::optional<OutputBuffer> rendered;
 
-        if (mod == 3) {
-            return this->getRegister(rm, w);
+    try {
+        InputFile input(path);
+        if ((recursive || use_labels || execute || ranged || !patch_args.empty()) && !input.isMapped()) {
+            throw std::runtime_error("[ERROR] -l, -r, -x, ranges and patches need a regular file.");
         }
 
-        const char* addr[] = {"bx + si", "bx + di", "bp + si", "bp + di", "si", "di", "bp", "bx"};
-
-        std::string size_prefix = include_size ? ((w) ? "word " : "byte ") : "";
-        std::string segment_prefix = this->ctx;
-
-        if (rm == 6 && mod == 0) {
-            return size_prefix + segment_prefix + "[" + std::to_string(readU16()) + "]";
+        if (!input.isMapped() && format.value_or(ImageFormat::Flat) != ImageFormat::Flat) {
+            throw std::runtime_error("[ERROR] --format com and exe need a regular file.");
         }
 
-        if (mod == 1) {
-            return size_prefix + segment_prefix + "[" + std::string(addr[rm]) + formatDisplacement<i8>() + "]";
-        } else if (mod == 2) {
-            return size_prefix + segment_prefix + "[" + std::string(addr[rm]) + formatDisplacement<i16>() + "]";
+        // Whole-image modes decode what the loader finds; -x, ranges and patches see the raw file.
+        ExecutableImage image;
+        image.code = input.bytes();
+        if (!(execute || ranged || from_binary || !patch_args.empty())) image = loadExecutable(input.bytes(), path, format);
+
+        std::optional<DecodeCache> cache;
+        DecodeCache::Key cache_key{};
+        if (cache_dir && input.isMapped() && !(recursive || execute || ranged || from_binary || searching || statistics || !patch_args.empty())) {
+            u32 variant = (to_binary ? 1 : 0) | (use_labels ? 2 : 0) | static_cast<u32>(image.format) << 4;
+            if (model) variant |= (model->cpuModel() == CpuModel::I8086) ? 4 : 8;
+
+            cache.emplace(cache_dir);
+            cache_key = DecodeCache::key(input.bytes(), variant);
+            if (cache->load(cache_key, output)) return finishOutput(output);
+            rendered.emplace();
         }
+        OutputBuffer& sink = rendered ? *rendered : output;
 
-        return size_prefix + segment_prefix + "[" + std::string(addr[rm]) + "]";
-    }
-
-    std::string getSegReg(u8 segReg) {
-        const char* sregs[] = {"es", "cs", "ss", "ds"};
-
-        return sregs[segReg];
-    }
-
-    template<typename T>
-    std::string formatDisplacement() {
-        auto disp_unsigned = (sizeof(T) == 1) ? this->readU8() : this->readU16();
-        auto disp_signed = static_cast<T>(disp_unsigned);
+        LabelIndex labels(use_labels ? image.origin + image.code.size() : 0);
+        NasmFormatter formatter(sink, use_labels ? &labels : nullptr, model);
 
-        if (disp_signed > 0) {
-            return " + " + std::to_string(disp_signed);
-        } else if (disp_signed < 0) {
-            return " - " + std::to_string(-disp_signed);
+        if (!execute && !to_binary && !from_binary && !searching && !statistics) {
+            formatter.header(image.origin);
+            putImageInfo(image, sink);
         }
 
-        return "";
-    }
-
-    u8 readU8() {
-        if (!isIndexValid(1)) throw std::runtime_error("[ERROR] Cannot read u8.");
-        return code[pc++];
-    }
-
-    u16 readU16() {
-        if (!isIndexValid(2)) throw std::runtime_error("[ERROR] Cannot read u16.");
-        u16 value = (code[pc + 1] << 8) | code[pc];
-        pc += 2;
-        return value;
-    }
-
-    static std::vector<u8> readBinaryFile(const std::string& filename) {
-        std::ifstream file(filename, std::ios::binary | std::ios::in);
-        if (!file) {
-            throw std::runtime_error("[ERROR] Cannot open file: " + filename);
+        if (statistics) {
+            auto stats = std::make_unique<DecodeStatistics>();
+            scanStatistics(input, image, *stats);
+            sink.put(kStatisticsCsvHeader);
+            writeStatisticsCsv(path, *stats, sink);
+        } else if (searching) {
+            MatchPrinter printer(idioms, sink);
+            formatInput(input, image, printer);
+        } else if (to_binary) {
+            BinaryWriter writer(sink);
+            writer.header(image.origin, image.format);
+            formatInput(input, image, writer);
+        } else if (from_binary) {
+            BinaryReader reader(path);
+            formatter.header(reader.origin());
+            for (std::size_t i = 0; i < reader.size(); i++) formatter.format(reader[i]);
+        } else if (!patch_args.empty()) {
+            std::vector<Patch> patches;
+            for (const std::string& arg : patch_args) patches.push_back(parsePatch(arg));
+            formatPatches(input, patches, formatter, sink);
+        } else if (execute) {
+            Cpu cpu;
+            cpu.load(input.bytes(), 0);
+            std::size_t steps = cpu.run(max_steps);
+            formatRegisters(cpu, steps, sink);
+            if (!cpu.halted()) {
+                throw std::runtime_error("[ERROR] Stopped after " + std::to_string(steps) + " instructions without halting; see --max-steps.");
+            }
+        } else if (ranged) {
+            formatRange(input, path, range_start, range_end, formatter);
+        } else if (recursive) {
+            if (entry_points.empty()) entry_points.push_back(image.entry);
+            ControlFlowGraph graph = RecursiveDisassembler(image.code, image.origin).run(entry_points);
+            if (use_labels) {
+                labels.add(graph.instructions);
+                labels.finish();
+            }
+            formatGraph(graph, formatter, sink, model);
+        } else if (use_labels) {
+            labels.collect(image.code, image.origin);
+            formatWindow(image.code, image.origin, true, formatter);
+        } else if (input.isMapped() && threads > 1 && !model && !image.origin) {
+            // A .COM image (origin 0x100) is at most one chunk, so it is decoded serially below.
+            ParallelDisassembler(threads).run(image.code, sink);
+        } else if (!input.isMapped() && threads > 1 && !model) {
+            PipelinedDisassembler().run(input.descriptor(), sink);
+        } else {
+            formatInput(input, image, formatter);
         }
 
-        file.seekg(0, std::ios::end);
-        std::size_t file_size = file.tellg();
-        file.seekg(0, std::ios::beg);
-
-        std::vector<u8> buffer(file_size);
-        file.read(reinterpret_cast<char*>(buffer.data()), file_size);
+        if (model && !execute) putTotalClocks(formatter, sink);
 
-        return buffer;
-    }
-
-    bool isIndexValid(std::size_t bytes) const {
-        return pc + bytes <= code.size();
-    }
-};
-
-int main(int argc, char* argv[]) {
-
-    if (argc != 2) {
-        std::cout << "[ERROR] Usage: " << argv[0] << " <filepath>" << std::endl;
+        if (cache) {
+            cache->store(cache_key, rendered->view());
+            output.append(rendered->view());
+        }
+    } catch (const std::runtime_error& e) {
+        if (rendered) output.append(rendered->view());
+        output.flush();
+        std::cerr << e.what() << std::endl;
         return 1;
     }
 
-    InstructionDecoder decoder(argv[1]);
-    decoder.decode();
-
-    return 0;
+    return finishOutput(output);
 }
-
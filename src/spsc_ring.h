@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <span>
+#include <vector>
+
+// Fixed-size ring between exactly one producer thread and one consumer thread.
+// Both sides work on contiguous runs of slots in place: the producer claims
+// free slots, fills them and publishes them; the consumer acquires published
+// slots, uses them and releases them. Positions only grow and are shared
+// through acquire/release atomics, so no lock is taken. A side that finds the
+// ring full or empty sleeps on the other side's position, which is how a slow
+// consumer holds the producer back while memory stays at the ring's size.
+template<typename T>
+class SpscRing {
+public:
+    explicit SpscRing(std::size_t capacity)
+        : slots(std::bit_ceil(std::max<std::size_t>(capacity, 1))), mask(slots.size() - 1) {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer: up to `max` free slots in a row, waiting until there is one.
+    std::span<T> claim(std::size_t max) {
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            std::size_t h = head.load(std::memory_order_acquire);
+            std::size_t free = slots.size() - (t - h);
+            if (free) return run(t, std::min(max, free));
+            head.wait(h, std::memory_order_acquire);
+        }
+    }
+
+    // Producer: hands the first `count` claimed slots to the consumer.
+    void publish(std::size_t count) {
+        if (!count) return;
+        tail.store(tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        tail.notify_one();
+    }
+
+    // Producer: nothing more will be published.
+    void close() {
+        tail.fetch_or(kClosed, std::memory_order_release);
+        tail.notify_one();
+    }
+
+    // Consumer: up to `max` published slots in a row, waiting until there is
+    // one; empty once the ring is closed and drained.
+    std::span<T> acquire(std::size_t max) {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        for (;;) {
+            std::size_t t = tail.load(std::memory_order_acquire);
+            std::size_t ready = (t & ~kClosed) - h;
+            if (ready) return run(h, std::min(max, ready));
+            if (t & kClosed) return {};
+            tail.wait(t, std::memory_order_acquire);
+        }
+    }
+
+    // Consumer: like acquire(), but returns an empty run instead of waiting.
+    std::span<T> tryAcquire(std::size_t max) {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        std::size_t ready = (tail.load(std::memory_order_acquire) & ~kClosed) - h;
+        return run(h, std::min(max, ready));
+    }
+
+    // Consumer: gives the first `count` acquired slots back to the producer.
+    void release(std::size_t count) {
+        if (!count) return;
+        head.store(head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        head.notify_one();
+    }
+
+private:
+    static constexpr std::size_t kClosed = std::size_t(1) << (8 * sizeof(std::size_t) - 1);
+
+    std::vector<T> slots;
+    std::size_t mask;
+    // Each position is written by one side only; keep them on separate cache lines.
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+
+    // Slots from `position` on, cut at the end of the storage.
+    std::span<T> run(std::size_t position, std::size_t count) {
+        std::size_t index = position & mask;
+        return {slots.data() + index, std::min(count, slots.size() - index)};
+    }
+};
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "decoder.h"
+#include "instruction.h"
+#include "instrumentation.h"
+#include "length_decoder.h"
+#include "length_rules.h"
+#include "output_buffer.h"
+
+// Histograms of an image: records and bytes, opcodes, ModRM bytes, prefixes,
+// and bigrams and trigrams of consecutive operations. Every table is a fixed
+// array indexed straight by the byte or operation. The trigram table is too
+// large to scan or clear per file, so the cells it has touched are listed and
+// only those are visited. Its cells are 16-bit so that the table stays in
+// cache while scanning; a cell that wraps carries into a 64-bit table, which
+// is also where totals are merged.
+class DecodeStatistics {
+public:
+    static constexpr std::size_t kOperations = static_cast<std::size_t>(Operation::Count);
+    // Prefix columns: lock, rep, repne, then es, cs, ss, ds overrides.
+    static constexpr std::string_view kPrefixNames[] = {"lock", "rep", "repne", "es", "cs", "ss", "ds"};
+
+    u64 records = 0;
+    u64 bytes = 0;
+    u64 truncated = 0;   // inputs that ended inside an instruction
+    std::array<u64, 256> opcodes{};
+    std::array<u64, 256> modrm{};
+    std::array<u64, std::size(kPrefixNames)> prefixes{};
+    std::array<u64, kOperations * kOperations> bigrams{};
+
+    DecodeStatistics() : trigrams(kOperations * kOperations * kOperations) {}
+
+    u64 trigram(std::size_t index) const { return trigrams[index] + (wide.empty() ? 0 : wide[index]); }
+
+    void prefetchTrigram(std::size_t index) const { __builtin_prefetch(&trigrams[index], 1); }
+
+    void countTrigram(std::size_t index) {
+        if (++trigrams[index] <= 1) carry(index);
+    }
+
+    // Trigram cells that are not zero, in no particular order.
+    std::span<const u32> usedTrigrams() const { return touched; }
+
+    void merge(const DecodeStatistics& other) {
+        auto add = [](auto& into, const auto& from) {
+            for (std::size_t i = 0; i < into.size(); i++) into[i] += from[i];
+        };
+        records += other.records;
+        bytes += other.bytes;
+        truncated += other.truncated;
+        add(opcodes, other.opcodes);
+        add(modrm, other.modrm);
+        add(prefixes, other.prefixes);
+        add(bigrams, other.bigrams);
+        if (wide.empty()) wide.resize(trigrams.size());
+        for (u32 index : other.touched) {
+            if (!trigram(index)) touched.push_back(index);
+            wide[index] += other.trigram(index);
+        }
+    }
+
+    void clear() {
+        records = bytes = truncated = 0;
+        opcodes.fill(0);
+        modrm.fill(0);
+        prefixes.fill(0);
+        bigrams.fill(0);
+        for (u32 index : touched) {
+            trigrams[index] = 0;
+            if (!wide.empty()) wide[index] = 0;
+        }
+        touched.clear();
+    }
+
+private:
+    std::vector<u16> trigrams;
+    std::vector<u64> wide;      // allocated on the first merge or overflow
+    std::vector<u32> touched;
+
+    // A cell went from 0 to 1, which is its first count unless it has wrapped
+    // before, or wrapped to 0, which is carried into `wide`.
+    void carry(std::size_t index) {
+        if (trigrams[index] == 1) {
+            if (wide.empty() || !wide[index]) touched.push_back(static_cast<u32>(index));
+            return;
+        }
+        if (wide.empty()) wide.resize(trigrams.size());
+        wide[index] += 0x10000;
+    }
+};
+
+// Fills DecodeStatistics without decoding: records are found by
+// LengthDecoder and nothing is decoded or formatted. The opcode and ModRM
+// bytes are read at each record's start, and the operation for the n-grams
+// comes from a table indexed by opcode and ModRM reg field, built once by
+// decoding each form. The operations of a batch of records are collected
+// first and the n-grams counted in a second loop, which can prefetch the
+// trigram cells ahead. Inputs may come in windows; n-grams carry across them.
+class StatisticsScanner {
+public:
+    explicit StatisticsScanner(DecodeStatistics& stats) : stats(stats) {}
+
+    // Counts the records of one window and returns how many bytes it used;
+    // as with InstructionDecoder, a non-final window stops short of its end.
+    std::size_t scan(std::span<const u8> code, bool final = true) {
+        static const std::array<Operation, 256 * 8> kOperationOf = makeOperationTable();
+
+        LengthDecoder decoder(code, 0, final);
+        std::array<u8, kBatch> lengths;
+        std::size_t pos = 0;
+
+        while (std::size_t count = decoder.lengths(lengths.data(), lengths.size())) {
+            for (std::size_t i = 0; i < count; i++) {
+                std::size_t end = pos + lengths[i];
+                std::size_t at = pos;
+                while (at < end && (kLengthRules[code[at]] & LengthRule::PrefixGroup)) {
+                    stats.prefixes[kPrefixColumn[code[at] & 0x3F]]++;
+                    at++;
+                }
+
+                Operation operation = Operation::None;
+                if (at < end) {
+                    u8 opcode = code[at];
+                    u8 reg = 0;
+                    stats.opcodes[opcode]++;
+                    if (kLengthRules[opcode] & LengthRule::HasModRM) {
+                        stats.modrm[code[at + 1]]++;
+                        reg = (code[at + 1] >> 3) & 7;
+                    }
+                    operation = kOperationOf[opcode * 8 + reg];
+                }
+                operations[i + 2] = static_cast<u8>(operation);
+                pos = end;
+            }
+            countNgrams(count);
+        }
+
+        stats.bytes += pos;
+        if (final && decoder.truncated()) stats.truncated++;
+        return pos;
+    }
+
+private:
+    static constexpr std::size_t kBatch = 4096;
+    static constexpr std::size_t kPrefetchDistance = 8;
+
+    DecodeStatistics& stats;
+    // The batch's operations from index 2, after the last two of the batch before.
+    // Entries past the batch are stale but valid, so prefetching never checks bounds.
+    std::array<u8, kBatch + 2 + kPrefetchDistance> operations{};
+    u64 seen = 0;
+
+    // Column of a prefix byte, by its low six bits: F0, F3, F2, 26, 2E, 36, 3E.
+    static constexpr std::array<u8, 64> kPrefixColumn = []() {
+        std::array<u8, 64> t{};
+        t[0xF0 & 0x3F] = 0;
+        t[0xF3 & 0x3F] = 1;
+        t[0xF2 & 0x3F] = 2;
+        t[0x26] = 3;
+        t[0x2E] = 4;
+        t[0x36] = 5;
+        t[0x3E] = 6;
+        return t;
+    }();
+
+    void countNgrams(std::size_t count) {
+        constexpr std::size_t K = DecodeStatistics::kOperations;
+        auto trigram = [this](std::size_t i) {
+            return (std::size_t(operations[i]) * K + operations[i + 1]) * K + operations[i + 2];
+        };
+
+        stats.records += count;
+
+        // The first two records of an input lack the history for an n-gram.
+        std::size_t i = 0;
+        for (; i < count && seen + i < 2; i++) {
+            if (seen + i == 1) stats.bigrams[operations[i + 1] * K + operations[i + 2]]++;
+        }
+        for (; i < count; i++) {
+            stats.prefetchTrigram(trigram(i + kPrefetchDistance));
+            stats.bigrams[operations[i + 1] * K + operations[i + 2]]++;
+            stats.countTrigram(trigram(i));
+        }
+
+        seen += count;
+        operations[0] = operations[count];
+        operations[1] = operations[count + 1];
+    }
+
+    static std::array<Operation, 256 * 8> makeOperationTable() {
+        std::array<Operation, 256 * 8> table{};
+        // Building the table is not decoding input; keep it out of the counts.
+        INSTRUMENT_ONLY(Instrumentation::Counters saved = Instrumentation::local());
+        for (std::size_t opcode = 0; opcode < 256; opcode++) {
+            for (u8 reg = 0; reg < 8; reg++) {
+                std::array<u8, kMaxInstructionLength> bytes{static_cast<u8>(opcode), static_cast<u8>(0xC0 | reg << 3)};
+                // Undefined group forms decode to None, which is kept for prefix-only records.
+                Operation operation = InstructionDecoder::decodeOne(bytes, 0).operation;
+                table[opcode * 8 + reg] = (operation == Operation::None) ? Operation::Unknown : operation;
+            }
+        }
+        INSTRUMENT_ONLY(Instrumentation::local() = saved);
+        return table;
+    }
+};
+
+// Per-thread tables for multi-file runs: each thread scans a file into its
+// own `file` tables, writes them and adds them to its own `total`, so no
+// counter is shared. The totals are merged once at the end.
+class StatisticsTotals {
+public:
+    struct Slot {
+        DecodeStatistics file;
+        DecodeStatistics total;
+    };
+
+    // The calling thread's tables. A process has one StatisticsTotals.
+    Slot& local() {
+        thread_local Slot* mine = nullptr;
+        if (!mine) {
+            std::lock_guard guard(lock);
+            all.push_back(std::make_unique<Slot>());
+            mine = all.back().get();
+        }
+        return *mine;
+    }
+
+    std::unique_ptr<DecodeStatistics> merged() {
+        std::lock_guard guard(lock);
+        auto total = std::make_unique<DecodeStatistics>();
+        for (const auto& slot : all) total->merge(slot->total);
+        return total;
+    }
+
+private:
+    std::mutex lock;
+    std::vector<std::unique_ptr<Slot>> all;
+};
+
+// Writes the cells that are not zero as CSV rows `file,histogram,key,count`,
+// a sparse matrix with one row per file and cell. Keys are hex bytes for
+// opcode and modrm, names for prefix, and mnemonics joined by `;` for the
+// n-grams, as in an idiom; prefix-only records count as "prefix" and unknown
+// opcodes as "unknown".
+inline constexpr std::string_view kStatisticsCsvHeader = "file,histogram,key,count\n";
+
+inline void writeStatisticsCsv(std::string_view file, const DecodeStatistics& stats, OutputBuffer& out) {
+    constexpr std::size_t K = DecodeStatistics::kOperations;
+
+    // Quoted when the name needs it.
+    std::string name;
+    if (file.find_first_of(",\"\n") == std::string_view::npos) {
+        name = file;
+    } else {
+        name = "\"";
+        for (char c : file) name += (c == '"') ? std::string("\"\"") : std::string(1, c);
+        name += '"';
+    }
+
+    auto mnemonic = [](std::size_t operation) -> std::string_view {
+        if (operation == static_cast<std::size_t>(Operation::None)) return "prefix";
+        if (operation == static_cast<std::size_t>(Operation::Unknown)) return "unknown";
+        return mnemonics[operation];
+    };
+    auto row = [&](std::string_view histogram, auto&& key, u64 count) {
+        out.reserve(name.size() + 96);
+        out.put(name);
+        out.put(',');
+        out.put(histogram);
+        out.put(',');
+        key();
+        out.put(',');
+        out.putInt(count);
+        out.put('\n');
+    };
+    auto hex = [&out](std::size_t byte) {
+        return [&out, byte]() {
+            out.put("0x");
+            if (byte < 0x10) out.put('0');
+            out.putInt(byte, 16);
+        };
+    };
+
+    row("total", [&]() { out.put("records"); }, stats.records);
+    row("total", [&]() { out.put("bytes"); }, stats.bytes);
+    row("total", [&]() { out.put("truncated"); }, stats.truncated);
+    for (std::size_t i = 0; i < 256; i++) {
+        if (stats.opcodes[i]) row("opcode", hex(i), stats.opcodes[i]);
+    }
+    for (std::size_t i = 0; i < 256; i++) {
+        if (stats.modrm[i]) row("modrm", hex(i), stats.modrm[i]);
+    }
+    for (std::size_t i = 0; i < stats.prefixes.size(); i++) {
+        if (stats.prefixes[i]) row("prefix", [&]() { out.put(DecodeStatistics::kPrefixNames[i]); }, stats.prefixes[i]);
+    }
+    for (std::size_t i = 0; i < stats.bigrams.size(); i++) {
+        if (!stats.bigrams[i]) continue;
+        row("bigram", [&]() {
+            out.put(mnemonic(i / K));
+            out.put(';');
+            out.put(mnemonic(i % K));
+        }, stats.bigrams[i]);
+    }
+
+    std::vector<u32> used(stats.usedTrigrams().begin(), stats.usedTrigrams().end());
+    std::sort(used.begin(), used.end());
+    for (u32 i : used) {
+        row("trigram", [&]() {
+            out.put(mnemonic(i / (K * K)));
+            out.put(';');
+            out.put(mnemonic(i / K % K));
+            out.put(';');
+            out.put(mnemonic(i % K));
+        }, stats.trigram(i));
+    }
+}
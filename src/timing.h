@@ -0,0 +1,260 @@
+#pragma once
+
+#include <array>
+
+#include "instruction.h"
+
+enum class CpuModel : u8 { I8086, I8088 };
+
+// Clock estimate for one instruction, from the execution times in the 8086
+// family user's manual. Instruction queue effects and wait states are not
+// modelled.
+struct InstructionClocks {
+    u16 base;       // execution clocks
+    u8 ea;          // effective address calculation, including a segment override
+    u8 penalty;     // 4 clocks per word transfer on the 8088's 8-bit bus, or at an odd address on the 8086
+    u16 not_taken;  // conditional transfers: clocks when they fall through; 0 otherwise
+
+    u32 total() const { return base + ea + penalty; }
+};
+
+// Effective address clocks by ModRM mod (0, or 1/2 with a displacement) and rm.
+inline constexpr std::array<std::array<u8, 8>, 2> kEffectiveAddressClocks = {{
+    {7, 8, 8, 7, 5, 5, 6, 5},      // [bx+si] [bx+di] [bp+si] [bp+di] [si] [di] [disp16] [bx]
+    {11, 12, 12, 11, 9, 9, 9, 9},  // the same plus disp8/disp16
+}};
+
+// Static per-instruction clock counts. Values that depend on data are fixed
+// where the manual gives a range: multiply and divide use the middle of the
+// range, shifts by cl are counted as a zero count, repeated string operations
+// as one iteration plus the rep setup, and conditional transfers as taken
+// (the fall-through cost is reported alongside).
+class TimingModel {
+public:
+    TimingModel(CpuModel model) : model(model) {}
+
+    CpuModel cpuModel() const { return model; }
+
+    InstructionClocks estimate(const DecodedInstruction& instr) const {
+        const Operand& dst = instr.operands[0];
+        const Operand& src = instr.operands[1];
+        bool to_memory = dst.kind == OperandKind::Memory;
+        bool memory = to_memory || src.kind == OperandKind::Memory;
+        bool immediate = src.kind == OperandKind::Immediate || src.kind == OperandKind::SignedImmediate;
+        bool word = instr.flags & InstructionFlags::Wide;
+
+        InstructionClocks clocks{};
+        u8 transfers = 0;
+
+        if (memory && (instr.flags & InstructionFlags::HasModRM)) {
+            clocks.ea = effectiveAddressClocks(instr);
+        }
+        // An override only costs when there is a memory operand for it to apply to.
+        if (memory && (instr.prefixes & Prefix::Segment)) clocks.ea += 2;
+
+        // Choose between register, memory-destination and memory-source costs.
+        auto pick = [&](u16 reg, u16 mem_dst, u8 dst_transfers, u16 mem_src, u8 src_transfers) {
+            if (to_memory) {
+                transfers = dst_transfers;
+                return mem_dst;
+            }
+            if (memory) {
+                transfers = src_transfers;
+                return mem_src;
+            }
+            return reg;
+        };
+
+        switch (instr.operation) {
+            case Operation::Mov:
+                if (memory && !(instr.flags & InstructionFlags::HasModRM)) {
+                    clocks.base = 10;
+                    transfers = 1;
+                } else if (immediate) {
+                    clocks.base = pick(4, 10, 1, 10, 1);
+                } else {
+                    clocks.base = pick(2, 9, 1, 8, 1);
+                }
+                break;
+            case Operation::Add: case Operation::Or: case Operation::Adc: case Operation::Sbb:
+            case Operation::And: case Operation::Sub: case Operation::Xor:
+                clocks.base = immediate ? pick(4, 17, 2, 17, 2) : pick(3, 16, 2, 9, 1);
+                break;
+            case Operation::Cmp:
+                clocks.base = immediate ? pick(4, 10, 1, 10, 1) : pick(3, 9, 1, 9, 1);
+                break;
+            case Operation::Test:
+                if (immediate) {
+                    // Only the A8/A9 form is the 4-clock accumulator row; F6/F7 on al/ax is reg, immed.
+                    bool accumulator_form = instr.opcode == 0xA8 || instr.opcode == 0xA9;
+                    clocks.base = pick(accumulator_form ? 4 : 5, 11, 1, 11, 1);
+                } else {
+                    clocks.base = pick(3, 9, 1, 9, 1);
+                }
+                break;
+            case Operation::Xchg:
+                clocks.base = (instr.opcode >= 0x90 && instr.opcode <= 0x97) ? 3 : pick(4, 17, 2, 17, 2);
+                break;
+            case Operation::Lea: clocks.base = 2; break;
+            case Operation::Les: case Operation::Lds:
+                clocks.base = 16;
+                transfers = 2;
+                break;
+            case Operation::Push:
+                word = true;
+                clocks.base = pick(isSegment(dst) ? 10 : 11, 16, 2, 16, 2);
+                if (!memory) transfers = 1;
+                break;
+            case Operation::Pop:
+                word = true;
+                clocks.base = pick(8, 17, 2, 17, 2);
+                if (!memory) transfers = 1;
+                break;
+            case Operation::Pushf: clocks.base = 10; transfers = 1; word = true; break;
+            case Operation::Popf: clocks.base = 8; transfers = 1; word = true; break;
+            case Operation::Lahf: case Operation::Sahf: clocks.base = 4; break;
+            case Operation::Inc: case Operation::Dec:
+                clocks.base = pick(word ? 2 : 3, 15, 2, 15, 2);
+                break;
+            case Operation::Neg: case Operation::Not:
+                clocks.base = pick(3, 16, 2, 16, 2);
+                break;
+            case Operation::Mul: clocks.base = multiplyClocks(word, memory, 74, 126); transfers = memory; break;
+            case Operation::Imul: clocks.base = multiplyClocks(word, memory, 89, 141); transfers = memory; break;
+            case Operation::Div: clocks.base = multiplyClocks(word, memory, 85, 153); transfers = memory; break;
+            case Operation::Idiv: clocks.base = multiplyClocks(word, memory, 107, 175); transfers = memory; break;
+            case Operation::Rol: case Operation::Ror: case Operation::Rcl: case Operation::Rcr:
+            case Operation::Sal: case Operation::Shr: case Operation::Sar:
+                clocks.base = (src.kind == OperandKind::Register) ? pick(8, 20, 2, 20, 2) : pick(2, 15, 2, 15, 2);
+                break;
+            case Operation::Cbw: clocks.base = 2; break;
+            case Operation::Cwd: clocks.base = 5; break;
+            case Operation::Daa: case Operation::Das: case Operation::Aaa: case Operation::Aas:
+                clocks.base = 4;
+                break;
+            case Operation::Aam: clocks.base = 83; break;
+            case Operation::Aad: clocks.base = 60; break;
+            case Operation::Xlat: clocks.base = 11; break;
+            case Operation::Wait: clocks.base = 3; break;
+            case Operation::Hlt: case Operation::Cmc: case Operation::Clc: case Operation::Stc:
+            case Operation::Cli: case Operation::Sti: case Operation::Cld: case Operation::Std:
+                clocks.base = 2;
+                break;
+            case Operation::Movs: case Operation::Cmps: case Operation::Scas:
+            case Operation::Lods: case Operation::Stos:
+                stringClocks(instr, clocks, transfers);
+                break;
+            case Operation::In: case Operation::Out:
+                clocks.base = (dst.kind == OperandKind::Immediate || src.kind == OperandKind::Immediate) ? 10 : 8;
+                transfers = 1;
+                break;
+            case Operation::Int: clocks.base = 51; transfers = 5; word = true; break;
+            case Operation::Int3: clocks.base = 52; transfers = 5; word = true; break;
+            case Operation::Into: clocks.base = 53; clocks.not_taken = 4; transfers = 5; word = true; break;
+            case Operation::Iret: clocks.base = 24; transfers = 3; word = true; break;
+            case Operation::Ret:
+                clocks.base = (dst.kind == OperandKind::None) ? 8 : 12;
+                transfers = 1;
+                word = true;
+                break;
+            case Operation::Retf:
+                clocks.base = (dst.kind == OperandKind::None) ? 18 : 17;
+                transfers = 2;
+                word = true;
+                break;
+            case Operation::Jmp:
+                word = true;
+                if (dst.kind == OperandKind::Register) {
+                    clocks.base = 11;
+                } else if (dst.kind == OperandKind::Memory) {
+                    clocks.base = 18;
+                    transfers = 1;
+                } else {
+                    clocks.base = 15;
+                }
+                break;
+            case Operation::JmpFar: clocks.base = 24; transfers = 2; word = true; break;
+            case Operation::Call:
+                word = true;
+                if (dst.kind == OperandKind::Register) {
+                    clocks.base = 16;
+                    transfers = 1;
+                } else if (dst.kind == OperandKind::Memory) {
+                    clocks.base = 21;
+                    transfers = 2;
+                } else if (dst.kind == OperandKind::Far) {
+                    clocks.base = 28;
+                    transfers = 2;
+                } else {
+                    clocks.base = 19;
+                    transfers = 1;
+                }
+                break;
+            case Operation::CallFar: clocks.base = 37; transfers = 4; word = true; break;
+            case Operation::Loop: clocks.base = 17; clocks.not_taken = 5; break;
+            case Operation::Loope: clocks.base = 18; clocks.not_taken = 6; break;
+            case Operation::Loopne: clocks.base = 19; clocks.not_taken = 5; break;
+            case Operation::Jcxz: clocks.base = 18; clocks.not_taken = 6; break;
+            case Operation::Esc:
+                clocks.base = memory ? 8 : 2;
+                transfers = memory;
+                break;
+            default:
+                if (instr.operation >= Operation::Jo && instr.operation <= Operation::Jnle) {
+                    clocks.base = 16;
+                    clocks.not_taken = 4;
+                }
+                break;
+        }
+
+        // Lock and rep cost 2 clocks each as plain prefixes; a rep that
+        // repeats a string operation is part of its cost above.
+        if (instr.prefixes & Prefix::Lock) clocks.base += 2;
+        if ((instr.prefixes & (Prefix::Rep | Prefix::Repne)) && !isStringOp(instr.operation)) clocks.base += 2;
+
+        if (word && transfers && (model == CpuModel::I8088 || oddAddress(instr))) {
+            clocks.penalty = 4 * transfers;
+        }
+        return clocks;
+    }
+
+private:
+    CpuModel model;
+
+    static u8 effectiveAddressClocks(const DecodedInstruction& instr) {
+        u8 mod = instr.modrm >> 6;
+        u8 rm = instr.modrm & 7;
+        return kEffectiveAddressClocks[mod == 0 ? 0 : 1][rm];
+    }
+
+    static bool isSegment(const Operand& operand) {
+        return operand.kind == OperandKind::Register && static_cast<Register>(operand.value) >= Register::Es;
+    }
+
+    // Every memory form of mul and div takes 6 clocks more than the register form.
+    static u16 multiplyClocks(bool word, bool memory, u16 byte_clocks, u16 word_clocks) {
+        return (word ? word_clocks : byte_clocks) + (memory ? 6 : 0);
+    }
+
+    static void stringClocks(const DecodedInstruction& instr, InstructionClocks& clocks, u8& transfers) {
+        bool repeated = instr.prefixes & (Prefix::Rep | Prefix::Repne);
+
+        switch (instr.operation) {
+            case Operation::Movs: clocks.base = repeated ? 9 + 17 : 18; transfers = 2; break;
+            case Operation::Cmps: clocks.base = repeated ? 9 + 22 : 22; transfers = 2; break;
+            case Operation::Scas: clocks.base = repeated ? 9 + 15 : 15; transfers = 1; break;
+            case Operation::Lods: clocks.base = repeated ? 9 + 13 : 12; transfers = 1; break;
+            default: clocks.base = repeated ? 9 + 10 : 11; transfers = 1; break;
+        }
+    }
+
+    // The only address known statically is a direct one; others are taken to be even.
+    static bool oddAddress(const DecodedInstruction& instr) {
+        for (const Operand& operand : instr.operands) {
+            if (operand.kind == OperandKind::Memory && static_cast<EffectiveAddress>(operand.value) == EffectiveAddress::Direct) {
+                return instr.displacement & 1;
+            }
+        }
+        return false;
+    }
+};